@@ -0,0 +1,33 @@
+#ifndef _BCSTAT_H_
+#define _BCSTAT_H_
+
+// Buffer cache and disk queue statistics, as returned by reading
+// the bcstat device (/dev/bcstat).
+
+#define BCSTAT         2    // major device number
+#define BCSTAT_NREGION 8    // histogram buckets
+#define BCSTAT_REGION  128  // blocks per bucket; the last bucket takes the rest
+
+struct bcstat {
+  // Buffer cache (bio.c)
+  uint nbuf;       // buffers in the cache
+  uint hits;       // block found valid in the cache
+  uint misses;     // block had to be read from disk
+  uint evictions;  // a valid block was replaced by another
+  uint waits;      // sleeps waiting for a busy buffer or a free one
+  uint rhits[BCSTAT_NREGION];   // hits by block number
+  uint rmisses[BCSTAT_NREGION]; // misses by block number
+
+  // Disk queue (ide.c).  Times are in units of 1024 TSC cycles.
+  uint ide_nreq;      // requests started
+  uint ide_depth;     // requests queued or in progress
+  uint ide_maxdepth;  // largest depth seen
+  uint ide_sumdepth;  // sum of depth at each enqueue
+  uint ide_seeks;     // sum of block distance between started requests
+  uint ide_sweeps;    // number of times the elevator wrapped around
+  uint ide_qtime;     // total time requests spent waiting in the queue
+  uint ide_svctime;   // total time requests spent at the disk
+  uint ide_maxtime;   // longest queue + service time of one request
+};
+
+#endif // _BCSTAT_H_
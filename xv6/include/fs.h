@@ -16,18 +16,32 @@
 // Inodes start at block 2.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define SECTSIZE 512  // disk sector size
+
+// Block size: a multiple of SECTSIZE, chosen at build time
+// (see BSIZE in the Makefile).  The kernel and mkfs must agree.
+#ifndef BSIZE
+#define BSIZE 512
+#endif
 
 // File system super block
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint bsize;        // Block size (bytes); 0 in old images means 512
+  uint flags;        // Feature flags (FS_*)
+  uint logstart;     // Block number of first log block
+  uint nlog;         // Number of log blocks; 0 means no log
 };
 
-#define NDIRECT 12
+#define FS_EXTENTS 0x1  // files are mapped by extents (see below)
+#define FS_HASHDIR 0x2  // large directories are hashed (see below)
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -36,9 +50,29 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
+};
+
+// In a file system with FS_EXTENTS, the blocks of a file are
+// a list of extents, runs of contiguous disk blocks, in file order.
+// The first NEXTENT extents are kept in dinode.addrs[], and
+// addrs[EXTIDX] points to an index block of struct extidx,
+// each of which points to a leaf block of up to EPB more extents.
+// Unused extents and index entries are zero.
+struct extent {
+  uint start;  // first disk block
+  uint len;    // number of blocks
+};
+
+struct extidx {
+  uint lbn;    // file block number at which the leaf starts
+  uint leaf;   // disk address of the leaf block
 };
 
+#define NEXTENT 6
+#define EXTIDX (2*NEXTENT)
+#define EPB (BSIZE / sizeof(struct extent))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -61,4 +95,24 @@ struct dirent {
 
 #define DPB (BSIZE / sizeof(struct dirent))
 
+// In a file system with FS_HASHDIR, a directory that outgrows its
+// first block is hashed.  Block 0 keeps its entries, block 1 becomes
+// a header block, and later entries go into a chain of bucket blocks
+// chosen by a hash of the name.  The header and bucket blocks start
+// with a struct dirhash in place of a dirent; in the header block,
+// w[0] is DIRMAGIC and w[1] the number of buckets, and the rest of
+// the block is a table giving the file block at the head of each
+// bucket's chain (0 if empty), DHPS entries per slot.  In a bucket
+// block, w[0] is DIRMAGIC and w[1] the next file block of the chain.
+// Every struct dirhash has inum 0, so programs that read a
+// directory as an array of dirents skip them.
+struct dirhash {
+  ushort inum;  // always 0
+  ushort w[DIRSIZ/sizeof(ushort)];
+};
+
+#define DIRMAGIC 0xd1a5
+#define DHPS (DIRSIZ/sizeof(ushort))
+#define NDIRBUCKET ((BSIZE/sizeof(struct dirhash) - 1) * DHPS)
+
 #endif // _FS_H_
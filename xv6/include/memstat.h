@@ -0,0 +1,20 @@
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+// Physical page allocator statistics, as returned by reading
+// the memstat device (/dev/memstat).
+
+#define MEMSTAT         3   // major device number
+#define MEMSTAT_NORDER  11  // block sizes: 2^0 to 2^10 pages
+
+struct memstat {
+  uint npage;     // pages managed by the allocator
+  uint nfree;     // free pages, including those in per-CPU magazines
+  uint ncached;   // free pages in per-CPU magazines
+  uint nblock[MEMSTAT_NORDER];  // free blocks of each order in the buddy lists
+  uint nsplit;    // blocks split to make smaller ones
+  uint nmerge;    // blocks merged with their free buddy
+  uint nfail;     // allocations that found no block big enough
+};
+
+#endif // _MEMSTAT_H_
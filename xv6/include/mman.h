@@ -0,0 +1,9 @@
+#ifndef _MMAN_H_
+#define _MMAN_H_
+
+// Memory protection options for use with mmap
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#endif //_MMAN_H_
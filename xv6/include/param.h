@@ -7,13 +7,19 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA          8  // memory mappings per process
+#define NPROGSEG      4  // loadable program segments per process
+#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*5)  // size of disk block cache
+#define NINODEMAX   500  // in-core i-nodes to keep cached
+#define NDCACHE      64  // size of directory name cache
+#define NPCACHE      64  // size of page cache for mapped files
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
-#define USERTOP  0xA0000 // end of user address space
-#define PHYSTOP  0x1000000 // use phys mem up to here as free pool
+#define USERTOP 0x80000000 // end of user address space (KERNBASE)
+#define PHYSTOP  0x1000000 // phys mem to assume if the boot loader has no map
+#define PHYSMAX 0x7E000000 // use no phys mem above here (DEVSPACE-KERNBASE)
 #define MAXARG       32  // max exec arguments
 
 #endif // _PARAM_H_
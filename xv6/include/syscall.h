@@ -23,5 +23,7 @@
 #define SYS_sbrk   19
 #define SYS_sleep  20
 #define SYS_uptime 21
+#define SYS_mmap   22
+#define SYS_munmap 23
 
 #endif // _SYSCALL_H_
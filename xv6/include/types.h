@@ -6,7 +6,9 @@
 typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
+typedef unsigned long long uint64;
 typedef uint pde_t;
+typedef uint pte_t;
 #ifndef NULL
 #define NULL (0)
 #endif
@@ -8,6 +8,8 @@
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to flush it to disk.
+// * To overlap several reads, call bread_async for each block and
+//     then bwait on each buffer before using its data.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -25,17 +27,31 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "bcstat.h"
+
+// bread_async leaves this many free buffers for bread, so that
+// read-ahead cannot use up the cache.
+#define BRESERVE (NBUF/4)
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  int nwait;  // processes in bget waiting for any free buffer
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+
+  // Statistics, read through the bcstat device.
+  struct bcstat stat;
 } bcache;
 
+static int bcstatread(struct inode*, char*, int);
+
 void
 binit(void)
 {
@@ -53,17 +69,50 @@ binit(void)
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
+  bcache.stat.nbuf = NBUF;
+
+  devsw[BCSTAT].read = bcstatread;
+}
+
+// Histogram bucket for sector.
+static int
+bcregion(uint sector)
+{
+  if(sector / BCSTAT_REGION >= BCSTAT_NREGION)
+    return BCSTAT_NREGION - 1;
+  return sector / BCSTAT_REGION;
+}
+
+// Return the number of buffers that bget could reuse.
+// Caller holds bcache.lock.
+static int
+bnfree(void)
+{
+  struct buf *b;
+  int n;
+
+  n = 0;
+  for(b = bcache.head.next; b != &bcache.head; b = b->next)
+    if((b->flags & (B_BUSY|B_DIRTY)) == 0)
+      n++;
+  return n;
 }
 
 // Look through buffer cache for sector on device dev.
 // If not found, allocate fresh block.
 // In either case, return locked buffer.
+// If no buffer is free, wait for one to be released.  If canfail
+// is set, return 0 instead, and also when few buffers are free.
 static struct buf*
-bget(uint dev, uint sector)
+bget(uint dev, uint sector, int canfail)
 {
   struct buf *b;
 
   acquire(&bcache.lock);
+  if(canfail && bnfree() <= BRESERVE){
+    release(&bcache.lock);
+    return 0;
+  }
 
  loop:
   // Try for cached block.
@@ -71,17 +120,31 @@ bget(uint dev, uint sector)
     if(b->dev == dev && b->sector == sector){
       if(!(b->flags & B_BUSY)){
         b->flags |= B_BUSY;
+        if(b->flags & B_VALID){
+          bcache.stat.hits++;
+          bcache.stat.rhits[bcregion(sector)]++;
+        } else {
+          bcache.stat.misses++;
+          bcache.stat.rmisses[bcregion(sector)]++;
+        }
         release(&bcache.lock);
         return b;
       }
+      bcache.stat.waits++;
       sleep(b, &bcache.lock);
       goto loop;
     }
   }
 
   // Allocate fresh block.
+  // A buffer that is not B_BUSY but is B_DIRTY is still in use:
+  // log.c has modified it but not yet committed it.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
+    if((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0){
+      if(b->flags & B_VALID)
+        bcache.stat.evictions++;
+      bcache.stat.misses++;
+      bcache.stat.rmisses[bcregion(sector)]++;
       b->dev = dev;
       b->sector = sector;
       b->flags = B_BUSY;
@@ -89,7 +152,15 @@ bget(uint dev, uint sector)
       return b;
     }
   }
-  panic("bget: no buffers");
+  if(canfail){
+    release(&bcache.lock);
+    return 0;
+  }
+  bcache.stat.waits++;
+  bcache.nwait++;
+  sleep(&bcache, &bcache.lock);
+  bcache.nwait--;
+  goto loop;
 }
 
 // Return a B_BUSY buf with the contents of the indicated disk sector.
@@ -98,12 +169,38 @@ bread(uint dev, uint sector)
 {
   struct buf *b;
 
-  b = bget(dev, sector);
+  b = bget(dev, sector, 0);
   if(!(b->flags & B_VALID))
     iderw(b);
   return b;
 }
 
+// Start reading the indicated sector, without waiting for the data.
+// Returns a B_BUSY buf that must be passed to bwait before its
+// data is used, or 0 if free buffers are short (the caller should
+// then fall back to bread).
+struct buf*
+bread_async(uint dev, uint sector)
+{
+  struct buf *b;
+
+  if((b = bget(dev, sector, 1)) == 0)
+    return 0;
+  if(!(b->flags & B_VALID))
+    idesubmit(b);
+  return b;
+}
+
+// Wait for the read started by bread_async on b to finish.
+void
+bwait(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bwait");
+  if(!(b->flags & B_VALID))
+    idewaitbuf(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -132,7 +229,25 @@ brelse(struct buf *b)
 
   b->flags &= ~B_BUSY;
   wakeup(b);
+  if(bcache.nwait > 0)
+    wakeup(&bcache);
 
   release(&bcache.lock);
 }
 
+// Read the buffer cache and disk queue statistics.
+// Returns a struct bcstat; n must be large enough to hold it.
+static int
+bcstatread(struct inode *ip, char *dst, int n)
+{
+  struct bcstat st;
+
+  if(n < sizeof(st))
+    return -1;
+  acquire(&bcache.lock);
+  st = bcache.stat;
+  release(&bcache.lock);
+  idestats(&st);
+  memmove(dst, &st, sizeof(st));
+  return sizeof(st);
+}
@@ -1,6 +1,7 @@
 #ifndef _BUF_H_
 #define _BUF_H_
 // IO Buffer
+// Users must include fs.h first, for BSIZE.
 struct buf {
   int flags;
   uint dev;
@@ -8,7 +9,8 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[512];
+  uint64 qtime;      // rdtsc when queued, for statistics
+  uchar data[BSIZE];
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
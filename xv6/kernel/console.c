@@ -8,8 +8,10 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "fs.h"
+#include "sleeplock.h"
 #include "file.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "proc.h"
 #include "x86.h"
 
@@ -118,7 +120,7 @@ panic(char *s)
 
 #define BACKSPACE 0x100
 #define CRTPORT 0x3d4
-static ushort *crt = (ushort*)0xb8000;  // CGA memory
+static ushort *crt = (ushort*)KADDR(0xb8000);  // CGA memory
 
 static void
 cgaputc(int c)
@@ -188,6 +190,7 @@ consoleintr(int (*getc)(void))
     switch(c){
     case C('P'):  // Process listing.
       procdump();
+      idedump();
       break;
     case C('U'):  // Kill line.
       while(input.e != input.w &&
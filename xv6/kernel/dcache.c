@@ -0,0 +1,168 @@
+// Directory name cache.
+//
+// Remembers the results of dirlookup, keyed by (device, directory
+// inode number, name): the inode number and offset of the entry,
+// or that the name is not in the directory (a negative entry,
+// inum 0).  namex can then resolve hot paths without scanning
+// directory blocks.
+//
+// Every change to a directory's entries must be reported:
+// dirlink and sys_unlink update the entry for the name, and
+// a directory that is freed or reorganized is purged with dcpurge.
+// Callers hold the directory's inode lock, which orders lookups
+// and updates for the same directory.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+
+#define NDCHASH 37
+
+struct dcentry {
+  struct dcentry *hnext;  // hash chain
+  struct dcentry *prev;   // LRU list, most recently used first
+  struct dcentry *next;
+  uint dev;
+  uint dir;     // directory inode number; 0 if the entry is unused
+  uint inum;    // 0 if name is not in dir
+  uint off;     // byte offset of the entry in dir
+  char name[DIRSIZ];
+};
+
+static struct {
+  struct spinlock lock;
+  struct dcentry entry[NDCACHE];
+  struct dcentry *hash[NDCHASH];
+  struct dcentry head;
+} dcache;
+
+void
+dcinit(void)
+{
+  struct dcentry *e;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(e = dcache.entry; e < dcache.entry+NDCACHE; e++){
+    e->next = dcache.head.next;
+    e->prev = &dcache.head;
+    dcache.head.next->prev = e;
+    dcache.head.next = e;
+  }
+}
+
+static uint
+dchash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*33 + (uchar)name[i];
+  return h % NDCHASH;
+}
+
+// Find the entry for (dev, dir, name).  Caller holds dcache.lock.
+static struct dcentry*
+dcfind(uint dev, uint dir, char *name)
+{
+  struct dcentry *e;
+
+  for(e = dcache.hash[dchash(dev, dir, name)]; e; e = e->hnext)
+    if(e->dev == dev && e->dir == dir && namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+// Move e to the front of the LRU list.  Caller holds dcache.lock.
+static void
+dctouch(struct dcentry *e)
+{
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+  e->next = dcache.head.next;
+  e->prev = &dcache.head;
+  dcache.head.next->prev = e;
+  dcache.head.next = e;
+}
+
+// Take e off its hash chain and mark it unused.
+// Caller holds dcache.lock.
+static void
+dcremove(struct dcentry *e)
+{
+  struct dcentry **pp;
+
+  if(e->dir == 0)
+    return;
+  for(pp = &dcache.hash[dchash(e->dev, e->dir, e->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == e){
+      *pp = e->hnext;
+      break;
+    }
+  }
+  e->dir = 0;
+}
+
+// Look up name in directory dir.  Returns 1 and sets *inum
+// (0 if the name is known to be absent) and *off if cached,
+// and 0 otherwise.
+int
+dclookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dev, dir, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dctouch(e);
+  *inum = e->inum;
+  *off = e->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dir is inode inum, with its
+// entry at offset off, or, if inum is 0, that it is absent.
+void
+dcenter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dcentry *e;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dev, dir, name)) == 0){
+    // Recycle the least recently used entry.
+    e = dcache.head.prev;
+    dcremove(e);
+    e->dev = dev;
+    e->dir = dir;
+    strncpy(e->name, name, DIRSIZ);
+    h = dchash(dev, dir, name);
+    e->hnext = dcache.hash[h];
+    dcache.hash[h] = e;
+  }
+  e->inum = inum;
+  e->off = off;
+  dctouch(e);
+  release(&dcache.lock);
+}
+
+// Forget all names in directory dir.
+void
+dcpurge(uint dev, uint dir)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.entry; e < dcache.entry+NDCACHE; e++)
+    if(e->dir == dir && e->dev == dev)
+      dcremove(e);
+  release(&dcache.lock);
+}
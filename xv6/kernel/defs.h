@@ -1,18 +1,25 @@
 #ifndef _DEFS_H_
 #define _DEFS_H_
 
+struct bcstat;
 struct buf;
 struct context;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct sleeplock;
+struct slab;
 struct spinlock;
 struct stat;
+struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
+void            bwait(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -22,6 +29,12 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// dcache.c
+void            dcinit(void);
+void            dcenter(uint, uint, char*, uint, uint);
+int             dclookup(uint, uint, char*, uint*, uint*);
+void            dcpurge(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -37,8 +50,10 @@ int             filewrite(struct file*, char*, int n);
 // fs.c
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            fsinit(int);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*, int);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -53,9 +68,13 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
+void            idedump(void);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idestats(struct bcstat*);
+void            idesubmit(struct buf*);
+void            idewaitbuf(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -64,8 +83,14 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kallocn(int);
+int             kavail(void);
+void            kdup(char*);
 void            kfree(char*);
+void            kfreen(char*, int);
 void            kinit(void);
+int             krefs(char*);
+extern uint     phystop;
 
 // kbd.c
 void            kbdintr(void);
@@ -78,18 +103,41 @@ void            lapicinit(int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
+// log.c
+void            initlog(int, struct superblock*);
+void            log_write(struct buf*);
+void            begin_op(void);
+void            end_op(void);
+
+// mmap.c
+int             mmap(struct file*, uint, uint, int);
+int             munmap(struct proc*, uint, uint);
+void            pcinit(void);
+void            pcpurge(struct inode*);
+void            pcupdate(struct inode*, uint, char*, uint);
+uint            vmabase(struct proc*);
+void            vmacopy(struct proc*, struct proc*);
+int             vmafault(struct proc*, struct vma*, uint, int);
+struct vma*     vmalookup(struct proc*, uint);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pci.c
+int             pcifind(int, int);
+uint            pciconfread(uint, int);
+void            pciconfwrite(uint, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
+void            pipeinit(void);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
@@ -113,6 +161,17 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+void*           slaballoc(struct slab*);
+void            slabfree(struct slab*, void*);
+void            slabinit(struct slab*, char*, uint);
+
+// sleeplock.c
+void            acquiresleep(struct sleeplock*);
+int             holdingsleep(struct sleeplock*);
+void            initsleeplock(struct sleeplock*, char*);
+void            releasesleep(struct sleeplock*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -133,6 +192,7 @@ char*           strncpy(char*, const char*, int);
 
 // syscall.c
 int             argint(int, int*);
+int             argoutptr(int, char**, int);
 int             argptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(struct proc*, uint, int*);
@@ -163,11 +223,14 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
+int             pagefault(struct proc*, uint, int);
+int             uvmcheck(struct proc*, uint, uint, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
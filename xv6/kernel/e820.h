@@ -0,0 +1,36 @@
+// The physical memory map, as reported by the BIOS (int 0x15,
+// %eax = 0xe820) or by a multiboot boot loader.
+
+// bootasm.S stores the BIOS map here: the 16-bit address past the
+// last entry, followed by the entries themselves.
+#define E820MAP   0x8000
+
+#define E820_RAM  1       // usable memory
+
+#define MB_MAGIC  0x2badb002  // in %eax from a multiboot loader
+#define MB_MMAP   (1<<6)      // mbinfo flags: mmap_* are valid
+
+#ifndef __ASSEMBLER__
+// An entry of the map.  The addresses are 64 bits, low word first.
+struct e820 {
+  uint addr[2];
+  uint len[2];
+  uint type;
+};
+
+// What a multiboot loader passes in %ebx; only the start is used.
+// Each entry of the map at mmap_addr is preceded by its size,
+// not counting the size field itself.
+struct mbinfo {
+  uint flags;
+  uint mem_lower;
+  uint mem_upper;
+  uint boot_device;
+  uint cmdline;
+  uint mods_count;
+  uint mods_addr;
+  uint syms[4];
+  uint mmap_length;
+  uint mmap_addr;
+};
+#endif
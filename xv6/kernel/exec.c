@@ -10,17 +10,22 @@ int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, n, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe, *oldexe;
   struct proghdr ph;
+  struct progseg seg[NPROGSEG];
   pde_t *pgdir, *oldpgdir;
 
-  if((ip = namei(path)) == 0)
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) < sizeof(elf))
@@ -31,21 +36,30 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments; their pages are read in
+  // from ip when first touched (see loadpage in vm.c).
   sz = 0;
+  n = 0;
+  memset(seg, 0, sizeof(seg));
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
     if(ph.type != ELF_PROG_LOAD)
       continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.va + ph.memsz)) == 0)
+    if(ph.memsz < ph.filesz || ph.va + ph.memsz < ph.va)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.va, ip, ph.offset, ph.filesz) < 0)
+    if(ph.va + ph.memsz > USERTOP || n >= NPROGSEG)
       goto bad;
+    seg[n].va = ph.va;
+    seg[n].filesz = ph.filesz;
+    seg[n].off = ph.offset;
+    n++;
+    if(ph.va + ph.memsz > sz)
+      sz = ph.va + ph.memsz;
   }
-  iunlockput(ip);
+  iunlock(ip);
+  end_op();
+  exe = ip;
   ip = 0;
 
   // Allocate a one-page stack at the next page boundary
@@ -81,20 +95,38 @@ exec(char *path, char **argv)
   safestrcpy(proc->name, last, sizeof(proc->name));
 
   // Commit to the user image.
+  munmap(proc, 0, USERTOP);
   oldpgdir = proc->pgdir;
+  oldexe = proc->exe;
   proc->pgdir = pgdir;
   proc->sz = sz;
+  proc->exe = exe;
+  iexec(exe, 1);
+  memmove(proc->seg, seg, sizeof(seg));
   proc->tf->eip = elf.entry;  // main
   proc->tf->esp = sp;
   switchuvm(proc);
   freevm(oldpgdir);
+  if(oldexe){
+    iexec(oldexe, -1);
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return 0;
 
  bad:
   if(pgdir)
     freevm(pgdir);
-  if(ip)
+  if(ip){
     iunlockput(ip);
+    end_op();
+  }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
@@ -17,18 +17,33 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  int flags;          // I_BUSY, I_VALID
+  struct inode *hnext; // icache hash chain
+  struct inode *prev; // icache LRU list, if ref is 0
+  struct inode *next;
+  struct sleeplock lock;
+  int flags;          // I_VALID
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint pstart;        // blocks reserved for the file by bfile,
+                      // free on disk (see fsinfo.resv)
+  uint plen;
+
+  uint dfree;         // directory: no free entry below this offset
+                      // (in a hashed directory, only block 0 counts)
+  int nent;           // directory: number of entries, -1 if unknown
+
+  int npage;          // pages in the page cache (see mmap.c)
+  int nexec;          // processes running this program (see iexec)
 };
 
-#define I_BUSY 0x1
 #define I_VALID 0x2
+#define I_FREEING 0x4  // iput is giving back the inode (see iget)
 
 
 // device implementations
@@ -1,14 +1,17 @@
-// File system implementation.  Four layers:
+// File system implementation.  Five layers:
 //   + Blocks: allocator for raw disk blocks.
+//   + Log: crash recovery for multi-step updates.
 //   + Files: inode allocator, reading, writing, metadata.
 //   + Directories: inode with special contents (list of other inodes!)
 //   + Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
 //
-// Disk layout is: superblock, inodes, block in-use bitmap, data blocks.
+// Disk layout is: superblock, inodes, block in-use bitmap, data blocks,
+// log.
 //
 // This file contains the low-level file system manipulation 
 // routines.  The (higher-level) system call implementations
-// are in sysfile.c.
+// are in sysfile.c.  Updates to disk blocks go through log_write
+// (log.c), so callers must be inside begin_op/end_op.
 
 #include "types.h"
 #include "defs.h"
@@ -17,12 +20,17 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
-#include "buf.h"
 #include "fs.h"
+#include "buf.h"
+#include "sleeplock.h"
+#include "slab.h"
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+// Largest file in bytes; with big blocks, the uint size is the limit.
+#define MAXSIZE (MAXFILE < 0xffffffff/BSIZE ? MAXFILE*BSIZE : 0xffffffff)
 static void itrunc(struct inode*);
+static void bdiscard(struct inode*);
 
 // Read the super block.
 static void
@@ -33,6 +41,8 @@ readsb(int dev, struct superblock *sb)
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
+  if(sb->bsize != BSIZE && !(sb->bsize == 0 && BSIZE == 512))
+    panic("readsb: block size mismatch");
 }
 
 // Zero a block.
@@ -43,56 +53,225 @@ bzero(int dev, int bno)
   
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
 // Blocks. 
+//
+// fsinit keeps an in-core copy of the super block and a summary of
+// the free block bitmap: the number of free blocks covered by each
+// bitmap block, so that balloc can skip full ones without reading
+// them, and a next-fit rotor, so that it does not rescan the
+// allocated blocks at the start of the disk on every call.
+// Only the bitmap blocks themselves record which blocks are free;
+// their buffer lock serializes changes to them.  Blocks reserved
+// for a file by bfile stay free in the bitmap until they are used,
+// so a crash cannot leak them; fsinfo.resv lists the files holding
+// reservations, so that ballocrun passes over the reserved blocks.
+
+#define MAXBMAP 32     // bitmap blocks covered by the summary
+#define MAXINODE 8192  // inodes covered by the free inode map
+#define NRESV 16       // files that can hold reserved blocks
+#define NPREALLOC 8    // blocks bfile reserves at once, plus 1
+
+static struct {
+  struct spinlock lock;
+  uint dev;
+  struct superblock sb;
+  uint nbmap;           // number of bitmap blocks
+  uint nfree[MAXBMAP];  // free blocks in each bitmap block
+  uint rotor;           // block after the last one allocated
+  uint imap[MAXINODE/32];  // inode in use (see ialloc)
+  uint iscan;           // inodes below this have valid imap bits
+  struct inode *resv[NRESV];  // files with blocks reserved by bfile
+} fsinfo;
+
+// Index of the lowest clear bit in w, which must not be all ones.
+static int
+ffz(uint w)
+{
+  int n;
+
+  w = ~w;
+  n = 0;
+  if((w & 0xffff) == 0){ n += 16; w >>= 16; }
+  if((w & 0xff) == 0){ n += 8; w >>= 8; }
+  if((w & 0xf) == 0){ n += 4; w >>= 4; }
+  if((w & 0x3) == 0){ n += 2; w >>= 2; }
+  if((w & 0x1) == 0)
+    n += 1;
+  return n;
+}
+
+// Find the first clear bit in bitmap block data at or after bit
+// from and before bit to, a word at a time.  Returns -1 if none.
+static int
+bscan(uchar *data, uint from, uint to)
+{
+  uint *w, i, word, b;
+
+  w = (uint*)data;
+  for(i = from/32; i*32 < to; i++){
+    word = w[i];
+    if(i == from/32)
+      word |= (1 << (from%32)) - 1;  // ignore bits before from
+    if(word == 0xffffffff)
+      continue;
+    b = i*32 + ffz(word);
+    return b < to ? b : -1;
+  }
+  return -1;
+}
 
-// Allocate a disk block.
+// Number of bits of bitmap block bb that stand for blocks on disk.
 static uint
-balloc(uint dev)
+bbits(uint bb)
 {
-  int b, bi, m;
+  return min(BPB, fsinfo.sb.size - bb*BPB);
+}
+
+// Read the super block of dev and summarize its free block bitmap.
+// Must be called from a process, before any other file system use.
+void
+fsinit(int dev)
+{
+  uint bb, bi;
   struct buf *bp;
-  struct superblock sb;
 
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use on disk.
-        bwrite(bp);
-        brelse(bp);
-        return b + bi;
+  initlock(&fsinfo.lock, "fsinfo");
+  fsinfo.dev = dev;
+  readsb(dev, &fsinfo.sb);
+  initlog(dev, &fsinfo.sb);  // replays the log, so before reading the bitmap
+  fsinfo.nbmap = (fsinfo.sb.size + BPB - 1) / BPB;
+  if(fsinfo.nbmap > MAXBMAP)
+    panic("fsinit: bitmap too large");
+  for(bb = 0; bb < fsinfo.nbmap; bb++){
+    bp = bread(dev, BBLOCK(bb*BPB, fsinfo.sb.ninodes));
+    fsinfo.nfree[bb] = 0;
+    for(bi = 0; bi < bbits(bb); bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        fsinfo.nfree[bb]++;
+    brelse(bp);
+  }
+  fsinfo.rotor = 0;
+
+  if(fsinfo.sb.ninodes > MAXINODE)
+    panic("fsinit: too many inodes");
+  memset(fsinfo.imap, 0, sizeof(fsinfo.imap));
+  fsinfo.imap[0] = 1;  // inode 0 is never used
+  fsinfo.iscan = 1;
+}
+
+// If block b is reserved for a file, return the block after the
+// reservation, else 0.  Caller holds fsinfo.lock.
+static uint
+bresv(uint b)
+{
+  struct inode *ip;
+  int i;
+
+  for(i = 0; i < NRESV; i++){
+    ip = fsinfo.resv[i];
+    if(ip && b >= ip->pstart && b < ip->pstart + ip->plen)
+      return ip->pstart + ip->plen;
+  }
+  return 0;
+}
+
+// Allocate a disk block and, if ip is not 0, reserve for ip up to
+// NPREALLOC-1 free blocks right after it (see bfile).  The block
+// is goal or, if goal is 0, after the last block allocated, or the
+// first free block found moving forward from there and wrapping
+// around the disk.
+static uint
+ballocrun(uint dev, uint goal, struct inode *ip)
+{
+  int bi, slot;
+  uint i, n, b, bb, from;
+  struct buf *bp;
+
+  if(dev != fsinfo.dev)
+    panic("balloc: dev");
+  if(goal == 0 || goal >= fsinfo.sb.size)
+    goal = fsinfo.rotor % fsinfo.sb.size;
+
+  // Visit goal's bitmap block last again, to see the part before goal.
+  for(i = 0; i <= fsinfo.nbmap; i++){
+    bb = (goal/BPB + i) % fsinfo.nbmap;
+    from = (i == 0) ? goal % BPB : 0;
+    acquire(&fsinfo.lock);
+    if(fsinfo.nfree[bb] == 0){
+      release(&fsinfo.lock);
+      continue;
+    }
+    release(&fsinfo.lock);
+
+    // Reservations are only made holding the bitmap block's buffer,
+    // so none can appear in this block while we look at it.
+    bp = bread(dev, BBLOCK(bb*BPB, fsinfo.sb.ninodes));
+    while((bi = bscan(bp->data, from, bbits(bb))) >= 0){
+      acquire(&fsinfo.lock);
+      if((b = bresv(bb*BPB + bi)) != 0){
+        release(&fsinfo.lock);
+        from = b - bb*BPB;
+        continue;
       }
+      // Mark the block in use on disk.
+      bp->data[bi/8] |= 1 << (bi % 8);
+      fsinfo.nfree[bb]--;
+      n = 1;
+      if(ip){
+        for(slot = 0; slot < NRESV && fsinfo.resv[slot]; slot++)
+          ;
+        while(slot < NRESV && n < NPREALLOC && bi+n < bbits(bb) &&
+              (bp->data[(bi+n)/8] & (1 << ((bi+n) % 8))) == 0 &&
+              !bresv(bb*BPB + bi + n))
+          n++;
+        ip->pstart = bb*BPB + bi + 1;
+        ip->plen = n - 1;
+        if(ip->plen > 0)
+          fsinfo.resv[slot] = ip;
+      }
+      fsinfo.rotor = bb*BPB + bi + n;
+      release(&fsinfo.lock);
+      log_write(bp);
+      brelse(bp);
+      return bb*BPB + bi;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block, preferring goal (see ballocrun).
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+
+  b = ballocrun(dev, goal, 0);
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
   struct buf *bp;
-  struct superblock sb;
   int bi, m;
 
-  bzero(dev, b);
-
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  bp = bread(dev, BBLOCK(b, fsinfo.sb.ninodes));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;  // Mark block free on disk.
-  bwrite(bp);
+  log_write(bp);
+  acquire(&fsinfo.lock);
+  fsinfo.nfree[b / BPB]++;
+  release(&fsinfo.lock);
   brelse(bp);
 }
 
@@ -110,15 +289,20 @@ bfree(int dev, uint b)
 // 
 // ip->ref counts the number of pointer references to this cached
 // inode; references are typically kept in struct file and in proc->cwd.
-// When ip->ref falls to zero, the inode is no longer cached.
 // It is an error to use an inode without holding a reference to it.
+// When ip->ref falls to zero, the inode stays cached, on an LRU
+// list, so that opening a recently closed file does not have to
+// read its inode again; iget reuses the least recently used
+// unreferenced inode once the cache holds NINODEMAX inodes.
+// Inodes come from a slab, so more than NINODEMAX can be in use;
+// the extra ones are freed when their last reference goes.
+// icache.lock protects ref, the hash chains and the LRU list.
 //
 // Processes are only allowed to read and write inode
 // metadata and contents when holding the inode's lock,
-// represented by the I_BUSY flag in the in-memory copy.
-// Because inode locks are held during disk accesses, 
-// they are implemented using a flag rather than with
-// spin locks.  Callers are responsible for locking
+// ip->lock.  Because inode locks are held during disk
+// accesses, they are sleep locks rather than spin locks.
+// Callers are responsible for locking
 // inodes before passing them to routines in this file; leaving
 // this responsibility with the caller makes it possible for them
 // to create arbitrarily-sized atomic operations.
@@ -129,42 +313,111 @@ bfree(int dev, uint b)
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slab slab;
+  struct inode *hash[NIHASH];
+  int n;              // number of in-core inodes
+
+  // Unreferenced inodes.  head.next is most recently used;
+  // inodes that hold no valid copy go at the other end.
+  struct inode head;
 } icache;
 
 void
 iinit(void)
 {
   initlock(&icache.lock, "icache");
+  icache.head.prev = &icache.head;
+  icache.head.next = &icache.head;
+  slabinit(&icache.slab, "inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Inode allocation.
+//
+// fsinfo.imap has a bit for each inode that is in use or being
+// allocated.  It is filled in lazily: when ialloc knows of no free
+// inode below fsinfo.iscan, it scans the next inode block, so each
+// block is read once however full the inode table gets.
+
+static void
+imapset(uint inum, int used)
+{
+  if(used)
+    ((uchar*)fsinfo.imap)[inum/8] |= 1 << (inum % 8);
+  else
+    ((uchar*)fsinfo.imap)[inum/8] &= ~(1 << (inum % 8));
+}
+
 // Allocate a new inode with the given type on device dev.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
+  uint i, first, last;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
 
-  readsb(dev, &sb);
-  for(inum = 1; inum < sb.ninodes; inum++){  // loop over inode blocks
-    bp = bread(dev, IBLOCK(inum));
+  if(dev != fsinfo.dev)
+    panic("ialloc: dev");
+  for(;;){
+    acquire(&fsinfo.lock);
+    if((inum = bscan((uchar*)fsinfo.imap, 0, fsinfo.iscan)) >= 0){
+      imapset(inum, 1);
+      release(&fsinfo.lock);
+      bp = bread(dev, IBLOCK(inum));
+    } else {
+      // Claim the rest of the next inode block and scan it.
+      first = fsinfo.iscan;
+      if(first >= fsinfo.sb.ninodes)
+        panic("ialloc: no inodes");
+      last = min(first - first%IPB + IPB, fsinfo.sb.ninodes);
+      for(i = first; i < last; i++)
+        imapset(i, 1);
+      fsinfo.iscan = last;
+      release(&fsinfo.lock);
+
+      bp = bread(dev, IBLOCK(first));
+      acquire(&fsinfo.lock);
+      for(i = first; i < last; i++){
+        dip = (struct dinode*)bp->data + i%IPB;
+        if(dip->type == 0 && inum < 0)
+          inum = i;
+        else if(dip->type == 0)
+          imapset(i, 0);
+      }
+      release(&fsinfo.lock);
+      if(inum < 0){
+        brelse(bp);
+        continue;
+      }
+    }
+
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
-      bwrite(bp);   // mark it allocated on the disk
+      log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
     }
-    brelse(bp);
+    brelse(bp);  // in use after all; leave it marked
   }
-  panic("ialloc: no inodes");
+}
+
+// Mark inode inum, whose type has been cleared on disk, free.
+static void
+ifree(uint inum)
+{
+  acquire(&fsinfo.lock);
+  if(inum < fsinfo.iscan)
+    imapset(inum, 0);
+  release(&fsinfo.lock);
 }
 
 // Copy inode, which has changed, from memory to disk.
@@ -182,40 +435,75 @@ iupdate(struct inode *ip)
   dip->nlink = ip->nlink;
   dip->size = ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
+// Take ip, which has no references, out of the cache's hash
+// table and forget its cached pages.  Caller holds icache.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  if(ip->inum != 0){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
+  if(ip->npage > 0)
+    pcpurge(ip);
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *nip;
 
   acquire(&icache.lock);
 
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+loop:
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->flags & I_FREEING){
+        // Wait for iput to finish truncating or freeing it.
+        sleep(ip, &icache.lock);
+        goto loop;
+      }
+      if(ip->ref++ == 0){
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+      }
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Allocate fresh inode.
-  if(empty == 0)
+  // Allocate a new inode if the cache can grow or must;
+  // otherwise recycle the least recently used unreferenced one.
+  ip = icache.head.prev;
+  if((ip == &icache.head || icache.n < NINODEMAX) &&
+     (nip = slaballoc(&icache.slab)) != 0){
+    initsleeplock(&nip->lock, "inode");
+    icache.n++;
+    ip = nip;
+  } else if(ip == &icache.head)
     panic("iget: no inodes");
+  else {
+    ip->next->prev = ip->prev;
+    ip->prev->next = ip->next;
+    iunhash(ip);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -232,6 +520,18 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count a process starting (n = 1) or no longer (n = -1)
+// running the program in ip.  Processes load pages from their
+// program file as they run (see exec.c), so writes to it are
+// refused while any process is running it.
+void
+iexec(struct inode *ip, int n)
+{
+  acquire(&icache.lock);
+  ip->nexec += n;
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 void
 ilock(struct inode *ip)
@@ -242,11 +542,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquire(&icache.lock);
-  while(ip->flags & I_BUSY)
-    sleep(ip, &icache.lock);
-  ip->flags |= I_BUSY;
-  release(&icache.lock);
+  acquiresleep(&ip->lock);
 
   if(!(ip->flags & I_VALID)){
     bp = bread(ip->dev, IBLOCK(ip->inum));
@@ -258,6 +554,8 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->dfree = 0;
+    ip->nent = -1;
     ip->flags |= I_VALID;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -268,13 +566,10 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
+  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  acquire(&icache.lock);
-  ip->flags &= ~I_BUSY;
-  wakeup(ip);
-  release(&icache.lock);
+  releasesleep(&ip->lock);
 }
 
 // Caller holds reference to unlocked ip.  Drop reference.
@@ -282,20 +577,49 @@ void
 iput(struct inode *ip)
 {
   acquire(&icache.lock);
-  if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
-    // inode is no longer used: truncate and free inode.
-    if(ip->flags & I_BUSY)
-      panic("iput busy");
-    ip->flags |= I_BUSY;
+  if(ip->ref == 1 &&
+     (ip->plen > 0 || ((ip->flags & I_VALID) && ip->nlink == 0))){
+    // last reference, so no one else holds the lock.
+    // I_FREEING keeps iget from handing ip out again meanwhile.
+    ip->flags |= I_FREEING;
     release(&icache.lock);
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
+    acquiresleep(&ip->lock);
+    // give back preallocated blocks.
+    bdiscard(ip);
+    if((ip->flags & I_VALID) && ip->nlink == 0){
+      // inode is no longer used: truncate and free inode.
+      if(ip->type == T_DIR)
+        dcpurge(ip->dev, ip->inum);
+      if(ip->npage > 0)
+        pcpurge(ip);
+      itrunc(ip);
+      ip->type = 0;
+      iupdate(ip);
+      ifree(ip->inum);
+      ip->flags &= ~I_VALID;
+    }
+    releasesleep(&ip->lock);
     acquire(&icache.lock);
-    ip->flags = 0;
+    ip->flags &= ~I_FREEING;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0 && icache.n > NINODEMAX){
+    // Over the cache's size: give the inode back.
+    iunhash(ip);
+    slabfree(&icache.slab, ip);
+    icache.n--;
+  } else if(ip->ref == 0){
+    // Keep a valid inode cached; reuse others first.
+    if(ip->flags & I_VALID){
+      ip->next = icache.head.next;
+      ip->prev = &icache.head;
+    } else {
+      ip->next = &icache.head;
+      ip->prev = icache.head.prev;
+    }
+    ip->next->prev = ip;
+    ip->prev->next = ip;
+  }
   release(&icache.lock);
 }
 
@@ -312,19 +636,261 @@ iunlockput(struct inode *ip)
 // The contents (data) associated with each inode is stored
 // in a sequence of blocks on the disk.  The first NDIRECT blocks
 // are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in the block ip->addrs[NDIRECT].
+// listed in the block ip->addrs[NDIRECT], and the NDINDIRECT
+// after those in the indirect blocks listed in the
+// double-indirect block ip->addrs[NDIRECT+1].  File systems made
+// with FS_EXTENTS use addrs[] for extents instead (see emap).
+
+// Where to look for a new direct block bn of ip (or for the
+// indirect block, bn == NDIRECT): just after the previous one.
+static uint
+bgoal(struct inode *ip, uint bn)
+{
+  if(bn > 0 && ip->addrs[bn-1])
+    return ip->addrs[bn-1] + 1;
+  return 0;
+}
+
+// Preallocation.
+//
+// A file that grows past its first block is probably being written
+// sequentially, so bfile reserves the next few free blocks after it
+// and hands them out as the file grows, marking each in the bitmap
+// only when it is used.  The reservation is kept in core (see
+// fsinfo.resv); iput gives back what is left when the last
+// reference goes away, as at close.  Directories grow a block at a
+// time and stay open as working directories, so they reserve none.
+
+// Allocate a zeroed block for ip's contents, preferring goal.
+// Caller must hold ip's lock.
+static uint
+bfile(struct inode *ip, uint goal)
+{
+  struct buf *bp;
+  uint b, bi;
+
+  if(ip->plen > 0 && (goal == 0 || goal == ip->pstart)){
+    b = ip->pstart;
+    bp = bread(ip->dev, BBLOCK(b, fsinfo.sb.ninodes));
+    bi = b % BPB;
+    if(bp->data[bi/8] & (1 << (bi % 8)))
+      panic("bfile: reserved block in use");
+    bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use on disk.
+    log_write(bp);
+    acquire(&fsinfo.lock);
+    fsinfo.nfree[b / BPB]--;
+    ip->pstart++;
+    ip->plen--;
+    release(&fsinfo.lock);
+    brelse(bp);
+    if(ip->plen == 0)
+      bdiscard(ip);
+  } else {
+    bdiscard(ip);  // not sequential after all
+    if(goal == 0 || ip->type == T_DIR)
+      return balloc(ip->dev, goal);
+    b = ballocrun(ip->dev, goal, ip);
+  }
+  bzero(ip->dev, b);
+  return b;
+}
+
+// Give back the blocks reserved for ip by bfile.
+static void
+bdiscard(struct inode *ip)
+{
+  int i;
+
+  acquire(&fsinfo.lock);
+  for(i = 0; i < NRESV; i++)
+    if(fsinfo.resv[i] == ip)
+      fsinfo.resv[i] = 0;
+  ip->plen = 0;
+  release(&fsinfo.lock);
+}
+
+// Extents.
+//
+// With FS_EXTENTS the blocks of a file are a list of extents (see
+// fs.h).  Files have no holes, so the extents are simply laid end
+// to end, and a file only grows by one block past its last extent;
+// the last extent is extended when the new block is contiguous.
+
+// Start a new leaf holding extent (addr, 1) for file block bn,
+// in slot next of ip's index block ibp (0 if there is none yet).
+// Returns -1 if the index is full.
+static int
+enewleaf(struct inode *ip, struct buf *ibp, uint next, uint bn, uint addr)
+{
+  struct extidx *x;
+  struct extent *e;
+  struct buf *bp;
+  uint leaf;
+
+  if(next >= EPB)
+    return -1;
+  if(ibp == 0){
+    ip->addrs[EXTIDX] = balloc(ip->dev, 0);
+    bp = bread(ip->dev, ip->addrs[EXTIDX]);
+  } else
+    bp = ibp;
+
+  leaf = balloc(ip->dev, 0);
+  x = (struct extidx*)bp->data;
+  x[next].lbn = bn;
+  x[next].leaf = leaf;
+  log_write(bp);
+  if(bp != ibp)
+    brelse(bp);
+
+  bp = bread(ip->dev, leaf);
+  e = (struct extent*)bp->data;
+  e[0].start = addr;
+  e[0].len = 1;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Return the disk block address of the nth block in extent-mapped
+// inode ip.  bn may be just past the end of the file, in which case
+// emap allocates it.  Returns 0 if the file can hold no more extents.
+static uint
+emap(struct inode *ip, uint bn)
+{
+  struct extent *e, *last;
+  struct extidx *x;
+  struct buf *ibp, *lbp;
+  uint i, j, lbn, addr;
+
+  // Look in the inode, then in the last leaf starting at or before bn.
+  e = (struct extent*)ip->addrs;
+  last = 0;
+  lbn = 0;
+  for(i = 0; i < NEXTENT && e[i].len; i++){
+    if(bn < lbn + e[i].len)
+      return e[i].start + bn - lbn;
+    lbn += e[i].len;
+    last = &e[i];
+  }
+
+  ibp = lbp = 0;
+  j = 0;
+  if(ip->addrs[EXTIDX]){
+    ibp = bread(ip->dev, ip->addrs[EXTIDX]);
+    x = (struct extidx*)ibp->data;
+    while(j+1 < EPB && x[j+1].leaf && x[j+1].lbn <= bn)
+      j++;
+    lbp = bread(ip->dev, x[j].leaf);
+    e = (struct extent*)lbp->data;
+    lbn = x[j].lbn;
+    for(i = 0; i < EPB && e[i].len; i++){
+      if(bn < lbn + e[i].len){
+        addr = e[i].start + bn - lbn;
+        brelse(lbp);
+        brelse(ibp);
+        return addr;
+      }
+      lbn += e[i].len;
+      last = &e[i];
+    }
+  }
+  if(bn != lbn)
+    panic("emap: hole");
+
+  // Allocate bn, growing the last extent if possible.
+  addr = bfile(ip, last ? last->start + last->len : 0);
+  if(last && addr == last->start + last->len){
+    last->len++;
+    if(lbp)
+      log_write(lbp);
+  } else if(i < (lbp ? EPB : NEXTENT)){
+    e[i].start = addr;
+    e[i].len = 1;
+    if(lbp)
+      log_write(lbp);
+  } else if(enewleaf(ip, ibp, ibp ? j+1 : 0, bn, addr) < 0){
+    bfree(ip->dev, addr);
+    addr = 0;
+  }
+  if(lbp)
+    brelse(lbp);
+  if(ibp)
+    brelse(ibp);
+  return addr;
+}
+
+// Free the n extents in e.
+static void
+efree(struct inode *ip, struct extent *e, uint n)
+{
+  uint i, b;
+
+  for(i = 0; i < n && e[i].len; i++){
+    for(b = 0; b < e[i].len; b++)
+      bfree(ip->dev, e[i].start + b);
+    e[i].start = 0;
+    e[i].len = 0;
+  }
+}
+
+// Discard the blocks of extent-mapped inode ip.
+static void
+etrunc(struct inode *ip)
+{
+  struct buf *ibp, *lbp;
+  struct extidx *x;
+  uint j;
+
+  efree(ip, (struct extent*)ip->addrs, NEXTENT);
+  if(ip->addrs[EXTIDX]){
+    ibp = bread(ip->dev, ip->addrs[EXTIDX]);
+    x = (struct extidx*)ibp->data;
+    for(j = 0; j < EPB && x[j].leaf; j++){
+      lbp = bread(ip->dev, x[j].leaf);
+      efree(ip, (struct extent*)lbp->data, EPB);
+      brelse(lbp);
+      bfree(ip->dev, x[j].leaf);
+    }
+    brelse(ibp);
+    bfree(ip->dev, ip->addrs[EXTIDX]);
+    ip->addrs[EXTIDX] = 0;
+  }
+}
+
+// Return entry bn of ip's indirect block addr,
+// allocating a block for it if necessary.
+static uint
+bindirect(struct inode *ip, uint addr, uint bn)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if(a[bn] == 0){
+    a[bn] = bfile(ip, bn > 0 && a[bn-1] ? a[bn-1] + 1 : addr + 1);
+    log_write(bp);
+  }
+  addr = a[bn];
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
+// Returns 0 if an extent-mapped file has no room for it.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
+
+  if(fsinfo.sb.flags & FS_EXTENTS)
+    return emap(ip, bn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = bfile(ip, bgoal(ip, bn));
     return addr;
   }
   bn -= NDIRECT;
@@ -332,20 +898,103 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      bwrite(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[NDIRECT] = addr = bfile(ip, bgoal(ip, NDIRECT));
+    return bindirect(ip, addr, bn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block under it.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = bfile(ip, 0);
+    addr = bindirect(ip, addr, bn / NINDIRECT);
+    return bindirect(ip, addr, bn % NINDIRECT);
   }
 
   panic("bmap: out of range");
 }
 
+// Read-ahead.
+//
+// Reading a run of file blocks one bread at a time leaves the disk
+// idle while each block is consumed.  A readahead keeps up to
+// NREADAHEAD blocks of the run in flight with bread_async, so that
+// the disk queue can work on several of them at once.
+// Blocks must be fetched in increasing order with raget, and raend
+// must be called before the inode is unlocked.  Read-ahead is
+// skipped when the buffer cache is short of free buffers (see
+// bread_async).
+
+#define NREADAHEAD 4
+
+struct readahead {
+  struct inode *ip;
+  uint next;   // next file block to submit
+  uint end;    // one past the last file block of the run
+  struct buf *buf[NREADAHEAD];  // block bn is in buf[bn % NREADAHEAD]
+};
+
+static void
+rainit(struct readahead *ra, struct inode *ip, uint start, uint end)
+{
+  ra->ip = ip;
+  ra->next = start;
+  ra->end = end;
+  memset(ra->buf, 0, sizeof(ra->buf));
+}
+
+// Return a locked buffer holding file block bn, submitting
+// reads for the blocks after it.
+static struct buf*
+raget(struct readahead *ra, uint bn)
+{
+  struct buf *bp;
+
+  for(; ra->next < ra->end && ra->next < bn + NREADAHEAD; ra->next++)
+    ra->buf[ra->next % NREADAHEAD] =
+      bread_async(ra->ip->dev, bmap(ra->ip, ra->next));
+
+  bp = ra->buf[bn % NREADAHEAD];
+  ra->buf[bn % NREADAHEAD] = 0;
+  if(bp == 0)
+    return bread(ra->ip->dev, bmap(ra->ip, bn));
+  bwait(bp);
+  return bp;
+}
+
+// Release blocks that were read ahead but not used.
+static void
+raend(struct readahead *ra)
+{
+  int i;
+
+  for(i = 0; i < NREADAHEAD; i++){
+    if(ra->buf[i]){
+      bwait(ra->buf[i]);
+      brelse(ra->buf[i]);
+      ra->buf[i] = 0;
+    }
+  }
+}
+
+// Free the blocks listed in ip's indirect block bp, and then
+// the indirect block itself.  Releases bp.
+static void
+bfreeindirect(struct inode *ip, struct buf *bp)
+{
+  int j;
+  uint *a, addr;
+
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(ip->dev, a[j]);
+  }
+  addr = bp->sector;
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called after the last dirent referring
 // to this inode has been erased on disk.
@@ -356,6 +1005,19 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  bdiscard(ip);
+  if(fsinfo.sb.flags & FS_EXTENTS){
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  // Start fetching the indirect block while the direct ones are freed.
+  bp = 0;
+  if(ip->addrs[NDIRECT])
+    bp = bread_async(ip->dev, ip->addrs[NDIRECT]);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -364,15 +1026,24 @@ itrunc(struct inode *ip)
   }
   
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    if(bp)
+      bwait(bp);
+    else
+      bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    bfreeindirect(ip, bp);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        bfreeindirect(ip, bread(ip->dev, a[j]));
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
   ip->size = 0;
@@ -396,6 +1067,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct readahead ra;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -408,12 +1080,14 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  rainit(&ra, ip, off/BSIZE, (off + n + BSIZE - 1)/BSIZE);
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = raget(&ra, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
+  raend(&ra);
   return n;
 }
 
@@ -421,7 +1095,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -432,15 +1106,21 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
-    n = MAXFILE*BSIZE - off;
+  if(!(fsinfo.sb.flags & FS_EXTENTS) && off + n > MAXSIZE)
+    n = MAXSIZE - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE)) == 0){
+      n = tot;  // out of extents
+      break;
+    }
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
-    bwrite(bp);
+    log_write(bp);
     brelse(bp);
+    if(ip->npage > 0)
+      pcupdate(ip, off, src, m);
   }
 
   if(n > 0 && off > ip->size){
@@ -458,66 +1138,290 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hash of a directory entry name, for hashed directories.
+// mkfs and fcheck compute the same hash.
+static uint
+namehash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return h;
+}
+
+// If dp is a hashed directory, return the bucket for name and set
+// *head to the first file block of its chain (0 if it is empty).
+// Otherwise return -1.
+static int
+dirbucket(struct inode *dp, char *name, uint *head)
+{
+  struct buf *bp;
+  struct dirhash *h;
+  int b;
+
+  if(!(fsinfo.sb.flags & FS_HASHDIR) || dp->size <= BSIZE)
+    return -1;
+  bp = bread(dp->dev, bmap(dp, 1));
+  h = (struct dirhash*)bp->data;
+  b = -1;
+  if(h->w[0] == DIRMAGIC && h->w[1] > 0 && h->w[1] <= NDIRBUCKET){
+    b = namehash(name) % h->w[1];
+    *head = h[1 + b/DHPS].w[b%DHPS];
+  }
+  brelse(bp);
+  return b;
+}
+
+// Look for name in block bn of a directory, held in bp.
+// If found, set *poff to the byte offset of the entry
+// and return its inode number; otherwise return 0.
+// If pfree is set, also lower *pfree to the first free entry
+// and add the number of entries passed over to *pn.
+static uint
+dirsearch(struct buf *bp, uint bn, char *name,
+          uint *poff, uint *pfree, int *pn)
+{
+  struct dirent *de;
+  uint off;
+
+  for(de = (struct dirent*)bp->data;
+      de < (struct dirent*)(bp->data + BSIZE);
+      de++){
+    off = bn*BSIZE + (uchar*)de - bp->data;
+    if(de->inum == 0){
+      if(pfree && off < *pfree)
+        *pfree = off;
+      continue;
+    }
+    if(pfree)
+      (*pn)++;
+    if(namecmp(name, de->name) == 0){
+      *poff = off;
+      return de->inum;
+    }
+  }
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 // Caller must have already locked dp.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, bn, free;
+  int n;
   struct buf *bp;
-  struct dirent *de;
+  struct readahead ra;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += BSIZE){
-    bp = bread(dp->dev, bmap(dp, off / BSIZE));
-    for(de = (struct dirent*)bp->data;
-        de < (struct dirent*)(bp->data + BSIZE);
-        de++){
-      if(de->inum == 0)
-        continue;
-      if(namecmp(name, de->name) == 0){
-        // entry matches path element
-        if(poff)
-          *poff = off + (uchar*)de - bp->data;
-        inum = de->inum;
+  if(dclookup(dp->dev, dp->inum, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  inum = 0;
+  if(dirbucket(dp, name, &bn) < 0){
+    // Linear directory: scan every block.  A scan that
+    // misses sees the whole directory, so it also finds
+    // the first free entry and the number of entries,
+    // which dirlink uses.
+    free = dp->size;
+    n = 0;
+    rainit(&ra, dp, 0, (dp->size + BSIZE - 1) / BSIZE);
+    for(bn = 0; bn*BSIZE < dp->size && inum == 0; bn++){
+      bp = raget(&ra, bn);
+      inum = dirsearch(bp, bn, name, &off, &free, &n);
+      brelse(bp);
+    }
+    raend(&ra);
+    if(inum == 0){
+      dp->dfree = free;
+      dp->nent = n;
+    }
+  } else {
+    // Hashed directory: scan block 0 and the bucket's chain.
+    bp = bread(dp->dev, bmap(dp, 0));
+    inum = dirsearch(bp, 0, name, &off, 0, 0);
+    brelse(bp);
+    while(inum == 0 && bn != 0){
+      bp = bread(dp->dev, bmap(dp, bn));
+      inum = dirsearch(bp, bn, name, &off, 0, 0);
+      bn = ((struct dirhash*)bp->data)->w[1];
+      brelse(bp);
+    }
+  }
+
+  if(inum == 0){
+    dcenter(dp->dev, dp->inum, name, 0, 0);
+    return 0;
+  }
+  dcenter(dp->dev, dp->inum, name, inum, off);
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
+
+// Return the offset of the first free entry in linear directory
+// dp, or dp->size if there is none, starting at the hint dp->dfree.
+// After dirlookup has missed, the hint is exact.
+static uint
+dirnextfree(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint off;
+
+  off = dp->dfree;
+  while(off < dp->size){
+    bp = bread(dp->dev, bmap(dp, off/BSIZE));
+    de = (struct dirent*)(bp->data + off%BSIZE);
+    for(; de < (struct dirent*)(bp->data + BSIZE) && off < dp->size; de++){
+      if(de->inum == 0){
         brelse(bp);
-        return iget(dp->dev, inum);
+        return off;
       }
+      off += sizeof(*de);
     }
     brelse(bp);
   }
+  return dp->size;
+}
+
+// Return the offset of a free entry in block bn of hashed
+// directory dp, or -1 if there is none.  If bn is a bucket
+// block, set *next to the next block in its chain.
+static int
+dirfree(struct inode *dp, uint bn, uint *next)
+{
+  struct buf *bp;
+  struct dirent *de;
+  int off;
+
+  bp = bread(dp->dev, bmap(dp, bn));
+  de = (struct dirent*)bp->data;
+  if(bn > 0){
+    *next = ((struct dirhash*)de)->w[1];
+    de++;
+  }
+  off = -1;
+  for(; de < (struct dirent*)(bp->data + BSIZE); de++){
+    if(de->inum == 0){
+      off = bn*BSIZE + (uchar*)de - bp->data;
+      break;
+    }
+  }
+  brelse(bp);
+  return off;
+}
+
+// Add file block bn, just past the end of hashed directory dp,
+// starting with h and otherwise zero.  Hashed directories grow
+// by whole blocks, as mkfs makes them, so the next block always
+// starts at the end of the file.
+static int
+dirgrow(struct inode *dp, uint bn, struct dirhash *h)
+{
+  // The unused tail of a partly used last block is already zero.
+  if(dp->size < bn*BSIZE)
+    dp->size = bn*BSIZE;
+  if(writei(dp, (char*)h, bn*BSIZE, sizeof(*h)) != sizeof(*h))
+    return -1;
+  dp->size = (bn+1)*BSIZE;
+  iupdate(dp);
   return 0;
 }
 
+// Find room for an entry in bucket b of hashed directory dp, whose
+// chain starts at file block bn: a free entry in block 0 or in the
+// chain, or else the first entry of a new block added to the chain.
+// Returns its offset, or -1 if the directory cannot grow.
+static int
+dirslot(struct inode *dp, int b, uint bn)
+{
+  struct dirhash h;
+  uint last, next;
+  ushort w;
+  int off;
+
+  if(dp->dfree < BSIZE && (off = dirfree(dp, 0, &next)) >= 0)
+    return off;
+  dp->dfree = BSIZE;
+  for(last = 0; bn != 0; last = bn, bn = next)
+    if((off = dirfree(dp, bn, &next)) >= 0)
+      return off;
+
+  bn = (dp->size + BSIZE - 1) / BSIZE;
+  if(bn > 0xffff)
+    return -1;
+  memset(&h, 0, sizeof(h));
+  h.w[0] = DIRMAGIC;
+  if(dirgrow(dp, bn, &h) < 0)
+    return -1;
+
+  // Link the new block from the header table or the end of the chain.
+  w = bn;
+  if(last == 0)
+    off = BSIZE + (1 + b/DHPS)*sizeof(h) + (1 + b%DHPS)*sizeof(w);
+  else
+    off = last*BSIZE + 2*sizeof(w);
+  if(writei(dp, (char*)&w, off, sizeof(w)) != sizeof(w))
+    panic("dirslot");
+  return bn*BSIZE + sizeof(h);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, b;
+  uint bn;
   struct dirent de;
+  struct dirhash h;
   struct inode *ip;
 
-  // Check that name is not present.
+  // Check that name is not present.  If dirlookup has to
+  // scan dp to tell, the same scan sets dp->dfree exactly.
   if((ip = dirlookup(dp, name, 0)) != 0){
     iput(ip);
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if((b = dirbucket(dp, name, &bn)) < 0){
+    // Look for an empty dirent.
+    off = dp->dfree = dirnextfree(dp);
+
+    // A full one-block directory becomes hashed by
+    // adding the header block; no entries move.
+    if(off == BSIZE && dp->size == BSIZE && (fsinfo.sb.flags & FS_HASHDIR)){
+      memset(&h, 0, sizeof(h));
+      h.w[0] = DIRMAGIC;
+      h.w[1] = NDIRBUCKET;
+      if(dirgrow(dp, 1, &h) < 0)
+        return -1;
+      b = dirbucket(dp, name, &bn);
+    }
   }
+  if(b >= 0 && (off = dirslot(dp, b, bn)) < 0)
+    return -1;
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp->dev, dp->inum, name, inum, off);
+  if(b < 0 || off < BSIZE)
+    dp->dfree = off + sizeof(de);
+  if(dp->nent >= 0)
+    dp->nent++;
   
   return 0;
 }
@@ -1,14 +1,19 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.  Transfers use PCI bus-master DMA when the
+// controller supports it (e.g. QEMU's PIIX), and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "bcstat.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
@@ -17,16 +22,79 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDMA  0xc8
+#define IDE_CMD_WDMA  0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Bus-master IDE registers, relative to idebm (primary channel).
+#define BM_CMD        0
+  #define BM_CMD_START  0x01  // start/stop the DMA engine
+  #define BM_CMD_READ   0x08  // transfer from disk to memory
+#define BM_STATUS     2
+  #define BM_ST_ACTIVE  0x01
+  #define BM_ST_ERR     0x02  // write 1 to clear
+  #define BM_ST_IRQ     0x04  // write 1 to clear
+#define BM_PRDT       4     // physical address of PRD table
+
+// Physical region descriptor: one contiguous piece of a transfer.
+// A region must not cross a 64 KB boundary.
+struct prd {
+  uint addr;
+  ushort count;  // bytes; 0 means 64 KB
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor in the table
+
+// Disk sectors per file system block.
+#define SPB           (BSIZE/SECTSIZE)
+
+// A block spans at most one 64 KB boundary, so two regions suffice.
+// The table itself must not cross a 64 KB boundary either.
+#define NPRD          2
+static struct prd prdt[NPRD] __attribute__((aligned(16)));
+
+static uint idebm;       // bus-master I/O base, 0 if none
+static int idedma;       // use DMA for new requests
+static int idedmabusy;   // the active request was started with DMA
+static int idemult;      // disks accept READ/WRITE MULTIPLE of SPB sectors
+static int idesect;      // sectors of the active PIO request done so far
+
+// Requests are served in C-SCAN (circular elevator) order.
+// idequeue points to the buf now being read/written to the disk,
+// followed by the rest of the current sweep in ascending sector order.
+// idenext holds requests for the next sweep, also in ascending order;
+// it becomes idequeue once the current sweep drains.
+// At most IDE_BATCH requests are admitted to a sweep after it starts,
+// so a stream of ascending requests cannot starve the next sweep.
+// You must hold idelock while manipulating the queues.
+
+#define IDE_BATCH     16
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idenext;
+static int idebatch;     // requests admitted to the current sweep
+
+// Queue statistics, protected by idelock.
+static struct {
+  uint nreq;       // requests started
+  uint depth;      // requests queued or in progress
+  uint maxdepth;   // largest depth seen
+  uint sumdepth;   // sum of depth at each enqueue
+  uint seeks;      // sum of sector distance between started requests
+  uint sweeps;     // number of times the elevator wrapped around
+  uint lastsector; // sector of the last started request
+  uint64 starttime; // rdtsc when the current request started
+  uint qtime;      // sum of queue wait, in 1024-cycle units
+  uint svctime;    // sum of service time, same units
+  uint maxtime;    // longest wait + service, same units
+} idestat;
 
 static int havedisk1;
 static void idestart(struct buf*);
+static void idelatency(struct buf*);
 
 // Wait for IDE disk to become ready.
 static int
@@ -41,10 +109,23 @@ idewait(int checkerr)
   return 0;
 }
 
+// Set the number of sectors per READ/WRITE MULTIPLE interrupt
+// on disk to SPB.  Returns -1 if the disk refuses.
+static int
+idesetmult(int disk)
+{
+  idewait(0);
+  outb(0x1f2, SPB);
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f7, IDE_CMD_SETMUL);
+  return idewait(1);
+}
+
 void
 ideinit(void)
 {
-  int i;
+  int i, bdf;
+  uint bar;
 
   initlock(&idelock, "ide");
   picenable(IRQ_IDE);
@@ -62,27 +143,118 @@ ideinit(void)
   
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Move a whole block per PIO interrupt if the disks allow it;
+  // otherwise PIO moves one sector per interrupt.
+  if(SPB > 1){
+    idemult = idesetmult(0) == 0 && (!havedisk1 || idesetmult(1) == 0);
+    if(!idemult)
+      cprintf("ide: no multiple mode, using single-sector pio\n");
+    outb(0x1f6, 0xe0 | (0<<4));
+  } else
+    idemult = 1;
+
+  // Look for a bus-master capable IDE controller.
+  if((bdf = pcifind(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE)) < 0)
+    return;
+  bar = pciconfread(bdf, PCI_BAR4);
+  if((bar & 1) == 0 || (bar & ~3) == 0)  // want an I/O space BAR
+    return;
+  pciconfwrite(bdf, PCI_COMMAND,
+               pciconfread(bdf, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+  idebm = bar & ~3;
+  idedma = 1;
+  cprintf("ide: bus-master dma at 0x%x\n", idebm);
+}
+
+// Fill in the PRD table for b and point the controller at it.
+static void
+idedmastart(struct buf *b)
+{
+  uint pa, n, len;
+  int i;
+
+  pa = PADDR(b->data);
+  n = sizeof(b->data);
+  for(i = 0; n > 0; i++){
+    if(i >= NPRD)
+      panic("idedmastart");
+    len = 0x10000 - (pa & 0xFFFF);
+    if(len > n)
+      len = n;
+    prdt[i].addr = pa;
+    prdt[i].count = len;
+    prdt[i].flags = 0;
+    pa += len;
+    n -= len;
+  }
+  prdt[i-1].flags = PRD_EOT;
+
+  outl(idebm + BM_PRDT, PADDR(prdt));
+  outb(idebm + BM_STATUS, inb(idebm + BM_STATUS) | BM_ST_ERR | BM_ST_IRQ);
+  outb(idebm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+}
+
+// Stop the DMA engine after a transfer.
+// Returns -1 if the controller or the disk reported an error.
+static int
+idedmadone(void)
+{
+  int s;
+
+  outb(idebm + BM_CMD, 0);
+  s = inb(idebm + BM_STATUS);
+  outb(idebm + BM_STATUS, s | BM_ST_ERR | BM_ST_IRQ);
+  if(idewait(1) < 0 || (s & BM_ST_ERR))
+    return -1;
+  return 0;
 }
 
 // Start the request for b.  Caller must hold idelock.
+// b->sector is a block number; each block is SPB disk sectors.
 static void
 idestart(struct buf *b)
 {
+  uint sector;
+
   if(b == 0)
     panic("idestart");
+  sector = b->sector * SPB;
+
+  idestat.nreq++;
+  if(b->sector > idestat.lastsector)
+    idestat.seeks += b->sector - idestat.lastsector;
+  else
+    idestat.seeks += idestat.lastsector - b->sector;
+  idestat.lastsector = b->sector;
+  idestat.starttime = rdtsc();
 
   idewait(0);
+  idedmabusy = idedma;
+  idesect = 0;
+  if(idedmabusy)
+    idedmastart(b);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  outb(0x1f2, SPB);  // number of sectors
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(idedmabusy){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WDMA : IDE_CMD_RDMA);
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
+    // With multiple mode the whole block moves with one interrupt;
+    // without it, ideintr sends the rest a sector at a time.
+    if(SPB > 1 && idemult){
+      outb(0x1f7, IDE_CMD_WRMUL);
+      outsl(0x1f0, b->data, BSIZE/4);
+    } else {
+      outb(0x1f7, IDE_CMD_WRITE);
+      outsl(0x1f0, b->data, SECTSIZE/4);
+    }
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, SPB > 1 && idemult ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
@@ -99,11 +271,48 @@ ideintr(void)
     // cprintf("spurious IDE interrupt\n");
     return;
   }
+
+  // A failed DMA transfer is retried with PIO, which stays in use.
+  if(idedmabusy && idedmadone() < 0){
+    cprintf("ide: dma error on sector %d, using pio\n", b->sector);
+    idedma = 0;
+    idestart(b);
+    release(&idelock);
+    return;
+  }
+
+  // Single-sector PIO interrupts once per sector: move the next
+  // sector and wait for the rest of the block.
+  if(!idedmabusy && !idemult && ++idesect < SPB){
+    if(idewait(1) >= 0){
+      if(b->flags & B_DIRTY)
+        outsl(0x1f0, b->data + idesect*SECTSIZE, SECTSIZE/4);
+      else
+        insl(0x1f0, b->data + (idesect-1)*SECTSIZE, SECTSIZE/4);
+    }
+    release(&idelock);
+    return;
+  }
+
   idequeue = b->qnext;
+  idestat.depth--;
+  idelatency(b);
+
+  // Current sweep done: wrap around to the next one.
+  if(idequeue == 0 && idenext != 0){
+    idequeue = idenext;
+    idenext = 0;
+    idebatch = 0;
+    idestat.sweeps++;
+  }
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
+  if(!idedmabusy && !(b->flags & B_DIRTY) && idewait(1) >= 0){
+    if(idemult)
+      insl(0x1f0, b->data, BSIZE/4);
+    else
+      insl(0x1f0, b->data + (SPB-1)*SECTSIZE, SECTSIZE/4);
+  }
   
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
@@ -117,38 +326,128 @@ ideintr(void)
   release(&idelock);
 }
 
-// Sync buf with disk. 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Insert b into the sorted list *pp.
+static void
+idesort(struct buf **pp, struct buf *b)
+{
+  for(; *pp && (*pp)->sector <= b->sector; pp=&(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Queue b in C-SCAN order.  Caller must hold idelock.
+// Requests ahead of the disk head join the current sweep
+// (until its batch limit is reached); the rest wait for the next.
+static void
+idequeue_insert(struct buf *b)
+{
+  b->qnext = 0;
+  if(idequeue == 0){
+    idequeue = b;
+    idebatch = 0;
+  } else if(b->sector > idequeue->sector && idebatch < IDE_BATCH){
+    idesort(&idequeue->qnext, b);
+    idebatch++;
+  } else {
+    idesort(&idenext, b);
+  }
+
+  b->qtime = rdtsc();
+  idestat.depth++;
+  idestat.sumdepth += idestat.depth;
+  if(idestat.depth > idestat.maxdepth)
+    idestat.maxdepth = idestat.depth;
+}
+
+// Account for the time b spent queued and at the disk.
+// Caller must hold idelock.
+static void
+idelatency(struct buf *b)
+{
+  uint wait, svc;
+
+  // Scale the 64-bit cycle counts before narrowing them,
+  // so a slow request can't wrap around.
+  wait = (idestat.starttime - b->qtime) >> 10;
+  svc = (rdtsc() - idestat.starttime) >> 10;
+  idestat.qtime += wait;
+  idestat.svctime += svc;
+  if(wait + svc > idestat.maxtime)
+    idestat.maxtime = wait + svc;
+}
+
+// Copy disk queue statistics into st, for the bcstat device.
 void
-iderw(struct buf *b)
+idestats(struct bcstat *st)
 {
-  struct buf **pp;
+  acquire(&idelock);
+  st->ide_nreq = idestat.nreq;
+  st->ide_depth = idestat.depth;
+  st->ide_maxdepth = idestat.maxdepth;
+  st->ide_sumdepth = idestat.sumdepth;
+  st->ide_seeks = idestat.seeks;
+  st->ide_sweeps = idestat.sweeps;
+  st->ide_qtime = idestat.qtime;
+  st->ide_svctime = idestat.svctime;
+  st->ide_maxtime = idestat.maxtime;
+  release(&idelock);
+}
 
+// Print disk queue statistics.  For debugging.
+// Runs when user types ^P on console.
+void
+idedump(void)
+{
+  uint n;
+
+  n = idestat.nreq ? idestat.nreq : 1;
+  cprintf("ide: %d reqs depth %d max %d avg %d seek avg %d sweeps %d\n",
+          idestat.nreq, idestat.depth, idestat.maxdepth,
+          idestat.sumdepth / n, idestat.seeks / n, idestat.sweeps);
+}
+
+// Queue b for the disk and return without waiting.
+// If B_DIRTY is set, b will be written to disk, clearing B_DIRTY
+// and setting B_VALID; else if B_VALID is not set, b will be read
+// from disk, setting B_VALID.  Use idewaitbuf to wait for completion.
+void
+idesubmit(struct buf *b)
+{
   if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
+    panic("idesubmit: buf not busy");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
+    panic("idesubmit: nothing to do");
   if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+    panic("idesubmit: ide disk 1 not present");
 
   acquire(&idelock);
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
-    ;
-  *pp = b;
-  
+  idequeue_insert(b);
+
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
-  
-  // Wait for request to finish.
+
+  release(&idelock);
+}
+
+// Wait for the request for b, if any, to finish.
+void
+idewaitbuf(struct buf *b)
+{
+  acquire(&idelock);
   // Assuming will not sleep too long: ignore proc->killed.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
   release(&idelock);
 }
+
+// Sync buf with disk.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  idewaitbuf(b);
+}
@@ -1,56 +1,275 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Pages can be shared (by copy-on-write fork, and between the
+// page cache and mapped files), so each page has a reference
+// count: kalloc returns a page with one reference, kdup adds
+// one, and kfree drops one, freeing the page when none are left.
+//
+// Underneath is a buddy allocator: free memory is kept in blocks
+// of 2^k pages, aligned to their size, for k up to KMAXORDER.
+// kallocn hands out whole blocks, splitting bigger ones as needed,
+// and a freed block merges with its buddy when that is free too.
+//
+// kinit finds the physical memory from the map the boot loader
+// left (see e820.h) and puts each usable range on the buddy lists
+// as a few big blocks.  The per-page arrays are sized to match and
+// live in the pages just after the kernel.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "fs.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "memstat.h"
+#include "e820.h"
+
+#define KMAXORDER (MEMSTAT_NORDER-1)
+
+// Each CPU keeps a magazine of free pages, so kalloc and kfree
+// usually need no lock.  A CPU refills an empty magazine, or
+// drains a full one, KBATCH pages at a time from the buddy lists.
+#define KMAG   32  // pages in a full magazine
+#define KBATCH 16  // pages moved to or from the buddy lists at once
+
+#define NMEMRANGE 32  // most ranges of usable memory kinit looks at
 
 struct run {
   struct run *next;
+  struct run *prev;  // in the buddy lists
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[KMAXORDER+1];  // buddy lists, by order
+  uint start;                    // first page number managed
+  uint end;                      // last page number managed, plus 1
+  uchar *order;                  // 1 + order of a free block, by first page
+  ushort *ref;                   // references to each page
+  struct memstat stat;
 } kmem;
 
+static struct {
+  struct run *freelist;
+  int n;
+} kmag[NCPU];
+
 extern char end[]; // first address after kernel loaded from ELF file
 
+uint phystop;  // end of the memory in the free pool
+uint mbinfo;   // physical address of struct mbinfo, if multiboot.S ran
+
+static int memstatread(struct inode*, char*, int);
+
+// Add the free block of 2^k pages at page number pn to the buddy
+// lists, merging it with its buddy while that is free.
+// Caller holds kmem.lock.
+static void
+bfree(uint pn, int k)
+{
+  struct run *r;
+  uint b;
+
+  for(; k < KMAXORDER; k++){
+    b = pn ^ (1 << k);
+    if(b < kmem.start || b + (1 << k) > kmem.end || kmem.order[b] != k+1)
+      break;
+    r = KADDR(b*PGSIZE);
+    r->next->prev = r->prev;
+    r->prev->next = r->next;
+    kmem.order[b] = 0;
+    kmem.stat.nblock[k]--;
+    kmem.stat.nmerge++;
+    pn &= ~(1 << k);
+  }
+  r = KADDR(pn*PGSIZE);
+  r->next = kmem.free[k].next;
+  r->prev = &kmem.free[k];
+  r->next->prev = r;
+  r->prev->next = r;
+  kmem.order[pn] = k+1;
+  kmem.stat.nblock[k]++;
+}
+
+// Take a free block of 2^k pages from the buddy lists,
+// splitting a bigger one if need be.  Caller holds kmem.lock.
+static struct run*
+balloc(int k)
+{
+  struct run *r;
+  uint pn;
+  int j;
+
+  for(j = k; j <= KMAXORDER && kmem.free[j].next == &kmem.free[j]; j++)
+    ;
+  if(j > KMAXORDER){
+    kmem.stat.nfail++;
+    return 0;
+  }
+  r = kmem.free[j].next;
+  r->next->prev = r->prev;
+  r->prev->next = r->next;
+  pn = PADDR(r)/PGSIZE;
+  kmem.order[pn] = 0;
+  kmem.stat.nblock[j]--;
+  while(j > k){
+    // Give back the upper half.
+    j--;
+    bfree(pn + (1 << j), j);
+    kmem.stat.nsplit++;
+  }
+  return r;
+}
+
+// Find the usable memory below PHYSMAX in the boot loader's map,
+// and store it in r as ranges of page numbers, [r[i][0], r[i][1]).
+// Returns the number of ranges, 0 if there is no map.
+static int
+memdetect(uint r[][2])
+{
+  struct mbinfo *mb;
+  struct e820 *e;
+  char *p, *ep, *next;
+  uint s, t;
+  int n;
+
+  if(mbinfo){
+    mb = KADDR(mbinfo);
+    if(!(mb->flags & MB_MMAP))
+      return 0;
+    p = KADDR(mb->mmap_addr);
+    ep = p + mb->mmap_length;
+  } else {
+    p = KADDR(E820MAP+4);
+    ep = KADDR(*(ushort*)KADDR(E820MAP));
+  }
+
+  n = 0;
+  for(; p < ep && n < NMEMRANGE; p = next){
+    if(mbinfo){
+      e = (struct e820*)(p+4);
+      next = p + 4 + *(uint*)p;
+    } else {
+      e = (struct e820*)p;
+      next = p + sizeof(*e);
+    }
+    if(e->type != E820_RAM || e->addr[1] != 0)
+      continue;
+    s = e->addr[0]/PGSIZE + (e->addr[0]%PGSIZE != 0);
+    if(e->len[1] != 0 || e->addr[0] + e->len[0] < e->addr[0])
+      t = PHYSMAX/PGSIZE;
+    else
+      t = (e->addr[0] + e->len[0])/PGSIZE;
+    if(t > PHYSMAX/PGSIZE)
+      t = PHYSMAX/PGSIZE;
+    if(s >= t)
+      continue;
+    r[n][0] = s;
+    r[n][1] = t;
+    n++;
+  }
+  return n;
+}
+
 // Initialize free list of physical pages.
 void
 kinit(void)
 {
-  char *p;
+  uint r[NMEMRANGE][2];
+  uint pn, e, npage;
+  int i, n, k;
 
   initlock(&kmem.lock, "kmem");
-  p = (char*)PGROUNDUP((uint)end);
-  for(; p + PGSIZE <= (char*)PHYSTOP; p += PGSIZE)
-    kfree(p);
+  for(k = 0; k <= KMAXORDER; k++)
+    kmem.free[k].next = kmem.free[k].prev = &kmem.free[k];
+
+  if((n = memdetect(r)) == 0){
+    r[0][0] = 0;
+    r[0][1] = PHYSTOP/PGSIZE;
+    n = 1;
+  }
+  phystop = 0;
+  for(i = 0; i < n; i++)
+    if(r[i][1]*PGSIZE > phystop)
+      phystop = r[i][1]*PGSIZE;
+
+  npage = phystop/PGSIZE;
+  kmem.ref = (ushort*)PGROUNDUP((uint)end);
+  kmem.order = (uchar*)(kmem.ref + npage);
+  memset(kmem.ref, 0, npage * (sizeof(kmem.ref[0]) + sizeof(kmem.order[0])));
+  kmem.start = PADDR(PGROUNDUP((uint)(kmem.order + npage)))/PGSIZE;
+  kmem.end = npage;
+
+  // Free each range as the biggest aligned blocks that fit,
+  // rather than page by page.
+  for(i = 0; i < n; i++){
+    pn = r[i][0] > kmem.start ? r[i][0] : kmem.start;
+    e = r[i][1];
+    while(pn < e){
+      for(k = KMAXORDER; (pn & ((1 << k) - 1)) || pn + (1 << k) > e; k--)
+        ;
+      bfree(pn, k);
+      kmem.stat.npage += 1 << k;
+      pn += 1 << k;
+    }
+  }
+  kmem.stat.nmerge = 0;
+
+  devsw[MEMSTAT].read = memstatread;
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, freeing it if that was the last one.  v normally
+// should have been returned by a call to kalloc().
 void
 kfree(char *v)
 {
   struct run *r;
+  int i;
 
-  if((uint)v % PGSIZE || v < end || (uint)v >= PHYSTOP) 
+  if((uint)v % PGSIZE || PADDR(v)/PGSIZE < kmem.start || PADDR(v) >= phystop)
     panic("kfree");
 
+  // Only a page with other references needs the lock: the
+  // holder of the last one is the only one who can touch it.
+  if(kmem.ref[PADDR(v)/PGSIZE] > 1){
+    acquire(&kmem.lock);
+    if(kmem.ref[PADDR(v)/PGSIZE] > 1){
+      kmem.ref[PADDR(v)/PGSIZE]--;
+      release(&kmem.lock);
+      return;
+    }
+    release(&kmem.lock);
+  }
+  kmem.ref[PADDR(v)/PGSIZE] = 0;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  acquire(&kmem.lock);
+  pushcli();
+  i = cpu - cpus;
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  r->next = kmag[i].freelist;
+  kmag[i].freelist = r;
+  if(++kmag[i].n > KMAG){
+    acquire(&kmem.lock);
+    while(kmag[i].n > KMAG - KBATCH){
+      r = kmag[i].freelist;
+      kmag[i].freelist = r->next;
+      kmag[i].n--;
+      bfree(PADDR(r)/PGSIZE, 0);
+    }
+    release(&kmem.lock);
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -58,14 +277,135 @@ kfree(char *v)
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
+{
+  struct run *r;
+  int i;
+
+  pushcli();
+  i = cpu - cpus;
+  if(kmag[i].n == 0){
+    acquire(&kmem.lock);
+    while(kmag[i].n < KBATCH && (r = balloc(0)) != 0){
+      r->next = kmag[i].freelist;
+      kmag[i].freelist = r;
+      kmag[i].n++;
+    }
+    release(&kmem.lock);
+  }
+  r = kmag[i].freelist;
+  if(r){
+    kmag[i].freelist = r->next;
+    kmag[i].n--;
+    kmem.ref[PADDR(r)/PGSIZE] = 1;
+  }
+  popcli();
+  return (char*)r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size.  Returns 0 if there is no free block that big.
+// The block must be freed with kfreen, and can't be shared.
+char*
+kallocn(int order)
 {
   struct run *r;
 
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > KMAXORDER)
+    return 0;
   acquire(&kmem.lock);
-  r = kmem.freelist;
+  r = balloc(order);
   if(r)
-    kmem.freelist = r->next;
+    kmem.ref[PADDR(r)/PGSIZE] = 1;
   release(&kmem.lock);
   return (char*)r;
 }
 
+// Free the 2^order pages at v, returned by kallocn(order).
+void
+kfreen(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > KMAXORDER || (uint)v % (PGSIZE << order) ||
+     PADDR(v)/PGSIZE < kmem.start || PADDR(v) + (PGSIZE << order) > phystop)
+    panic("kfreen");
+
+#ifdef KALLOC_JUNK
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PADDR(v)/PGSIZE] != 1)
+    panic("kfreen: shared");
+  kmem.ref[PADDR(v)/PGSIZE] = 0;
+  bfree(PADDR(v)/PGSIZE, order);
+  release(&kmem.lock);
+}
+
+// Add a reference to the page at v, which must be allocated.
+void
+kdup(char *v)
+{
+  if((uint)v % PGSIZE || PADDR(v)/PGSIZE < kmem.start || PADDR(v) >= phystop)
+    panic("kdup");
+  acquire(&kmem.lock);
+  if(kmem.ref[PADDR(v)/PGSIZE] < 1)
+    panic("kdup: free page");
+  kmem.ref[PADDR(v)/PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to the page at v.
+int
+krefs(char *v)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PADDR(v)/PGSIZE];
+  release(&kmem.lock);
+  return n;
+}
+
+// Return the number of free pages.
+int
+kavail(void)
+{
+  int i, k, n;
+
+  n = 0;
+  acquire(&kmem.lock);
+  for(k = 0; k <= KMAXORDER; k++)
+    n += kmem.stat.nblock[k] << k;
+  release(&kmem.lock);
+  for(i = 0; i < NCPU; i++)
+    n += kmag[i].n;
+  return n;
+}
+
+// Read the allocator statistics.
+// Returns a struct memstat; n must be large enough to hold it.
+static int
+memstatread(struct inode *ip, char *dst, int n)
+{
+  struct memstat st;
+  int i, k;
+
+  if(n < sizeof(st))
+    return -1;
+  acquire(&kmem.lock);
+  st = kmem.stat;
+  release(&kmem.lock);
+  st.ncached = 0;
+  for(i = 0; i < NCPU; i++)
+    st.ncached += kmag[i].n;
+  st.nfree = st.ncached;
+  for(k = 0; k <= KMAXORDER; k++)
+    st.nfree += st.nblock[k] << k;
+  memmove(dst, &st, sizeof(st));
+  return sizeof(st);
+}
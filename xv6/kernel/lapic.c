@@ -5,6 +5,7 @@
 #include "defs.h"
 #include "traps.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "x86.h"
 
 // Local APIC registers, divided by 4 for use as uint[] indices.
@@ -144,7 +145,7 @@ lapicstartap(uchar apicid, uint addr)
   // the AP startup code prior to the [universal startup algorithm]."
   outb(IO_RTC, 0xF);  // offset 0xF is shutdown code
   outb(IO_RTC+1, 0x0A);
-  wrv = (ushort*)(0x40<<4 | 0x67);  // Warm reset vector
+  wrv = (ushort*)KADDR((0x40<<4 | 0x67));  // Warm reset vector
   wrv[0] = 0;
   wrv[1] = addr >> 4;
 
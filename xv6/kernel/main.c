@@ -2,6 +2,7 @@
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "proc.h"
 #include "x86.h"
 
@@ -52,7 +53,10 @@ mainc(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipes
   iinit();         // inode cache
+  dcinit();        // directory name cache
+  pcinit();        // page cache
   ideinit();       // disk
   if(!ismp)
     timerinit();   // uniprocessor timer
@@ -93,6 +97,7 @@ static void
 bootothers(void)
 {
   extern uchar _binary_bootother_start[], _binary_bootother_size[];
+  extern pde_t entrypgdir[];
   uchar *code;
   struct cpu *c;
   char *stack;
@@ -100,21 +105,23 @@ bootothers(void)
   // Write bootstrap code to unused memory at 0x7000.
   // The linker has placed the image of bootother.S in
   // _binary_bootother_start.
-  code = (uchar*)0x7000;
+  code = KADDR(0x7000);
   memmove(code, _binary_bootother_start, (uint)_binary_bootother_size);
 
   for(c = cpus; c < cpus+ncpu; c++){
     if(c == cpus+cpunum())  // We've started already.
       continue;
 
-    // Tell bootother.S what stack to use and the address of mpmain;
-    // it expects to find these two addresses stored just before
-    // its first instruction.
+    // Tell bootother.S what stack to use, the address of mpmain,
+    // and the page directory to turn paging on with; it expects
+    // to find these three addresses stored just before its first
+    // instruction.
     stack = kalloc();
     *(void**)(code-4) = stack + KSTACKSIZE;
     *(void**)(code-8) = mpmain;
+    *(uint*)(code-12) = PADDR(entrypgdir);
 
-    lapicstartap(c->id, (uint)code);
+    lapicstartap(c->id, PADDR(code));
 
     // Wait for cpu to finish mpmain()
     while(c->booted == 0)
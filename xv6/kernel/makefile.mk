@@ -3,6 +3,7 @@
 KERNEL_OBJECTS := \
 	bio.o\
 	console.o\
+	dcache.o\
 	exec.o\
 	file.o\
 	fs.o\
@@ -11,11 +12,16 @@ KERNEL_OBJECTS := \
 	kalloc.o\
 	kbd.o\
 	lapic.o\
+	log.o\
 	main.o\
+	mmap.o\
 	mp.o\
+	pci.o\
 	picirq.o\
 	pipe.o\
 	proc.o\
+	slab.o\
+	sleeplock.o\
 	spinlock.o\
 	string.o\
 	swtch.o\
@@ -93,10 +99,11 @@ xv6.img: kernel/bootblock kernel/kernel
 	dd if=kernel/bootblock of=xv6.img conv=notrunc
 	dd if=kernel/kernel of=xv6.img seek=1 conv=notrunc
 
+# the kernel is linked at KERNLINK (memlayout.h) and loaded at 0x100000
 kernel/kernel:	\
 		$(KERNEL_OBJECTS) kernel/multiboot.o kernel/data.o bootother initcode
 	$(LD) $(LDFLAGS) $(KERNEL_LDFLAGS) \
-		--section-start=.text=0x100000 --entry=main --output=kernel/kernel \
+		--section-start=.text=0x80100000 --entry=_start --output=kernel/kernel \
 		kernel/multiboot.o kernel/data.o $(KERNEL_OBJECTS) \
 		-b binary initcode bootother
 
@@ -0,0 +1,11 @@
+// Memory layout
+
+#define EXTMEM   0x100000            // Start of extended memory
+#define KERNBASE 0x80000000          // First kernel virtual address
+#define KERNLINK (KERNBASE+EXTMEM)   // Address where kernel is linked
+#define DEVSPACE 0xFE000000          // Devices, such as the ioapic, mapped direct
+
+// The kernel maps all of physical memory at KERNBASE, so a kernel
+// virtual address below DEVSPACE is KERNBASE plus its physical address.
+#define PADDR(a)  ((uint)(a) - KERNBASE)
+#define KADDR(pa) ((void*)((uint)(pa) + KERNBASE))
@@ -0,0 +1,408 @@
+// Mapped files.
+//
+// mmap maps part of a file into the top of a process's address
+// space, below USERTOP, recording it in a VMA (struct vma in proc.h).
+// Pages are mapped when first touched (see vmafault).  A read maps
+// the page cache's copy of the file page itself, read-only, so no
+// data is copied at all.  With PROT_WRITE, the page is mapped
+// copy-on-write, so the first write to it gives the process a
+// private copy; writes never reach the file.
+//
+// The page cache holds file pages by inode and offset.  A mapping
+// holds a reference to the physical page (see kalloc.c), so a page
+// is in use while it has more than the cache's own.  A page stays
+// cached after its last mapping goes away, until its slot is needed
+// for another page or its inode leaves the inode cache.  writei keeps
+// cached pages up to date with pcupdate, so writes to the file show
+// through mappings that have not made a private copy.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "memlayout.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+#define NPCHASH 61
+#define PCHASH(ip, off) ((((uint)(ip) >> 4) + (off)/PGSIZE) % NPCHASH)
+
+struct pcpage {
+  struct inode *ip;      // file; 0 if the slot is unused
+  uint off;              // offset of page in file
+  char *data;            // the page; 0 until the slot is first used
+  struct pcpage *hnext;  // hash chain
+  struct pcpage *prev;   // LRU list
+  struct pcpage *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *hash[NPCHASH];
+
+  // All pages, most recently used first.
+  struct pcpage head;
+} pcache;
+
+static void
+pcunlink(struct pcpage *pg)
+{
+  pg->next->prev = pg->prev;
+  pg->prev->next = pg->next;
+}
+
+// Put pg on the LRU list: at the front if it is worth keeping.
+static void
+pcidle(struct pcpage *pg, int keep)
+{
+  if(keep){
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+  } else {
+    pg->next = &pcache.head;
+    pg->prev = pcache.head.prev;
+  }
+  pg->next->prev = pg;
+  pg->prev->next = pg;
+}
+
+static void
+pcunhash(struct pcpage *pg)
+{
+  struct pcpage **pp;
+
+  for(pp = &pcache.hash[PCHASH(pg->ip, pg->off)]; *pp != pg; pp = &(*pp)->hnext)
+    ;
+  *pp = pg->hnext;
+  pg->ip->npage--;
+  pg->ip = 0;
+}
+
+void
+pcinit(void)
+{
+  struct pcpage *pg;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++)
+    pcidle(pg, 0);
+}
+
+// Look for the page of ip at offset off.
+// Caller holds pcache.lock.
+static struct pcpage*
+pcfind(struct inode *ip, uint off)
+{
+  struct pcpage *pg;
+
+  for(pg = pcache.hash[PCHASH(ip, off)]; pg; pg = pg->hnext)
+    if(pg->ip == ip && pg->off == off)
+      return pg;
+  return 0;
+}
+
+// Return the cached page of ip at offset off, with a reference
+// for the caller, reading it in if it is not cached.  Caller
+// holds ip's lock.  Returns 0 if every page is in use or memory
+// is short.
+static char*
+pcget(struct inode *ip, uint off)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip, off)) != 0){
+    pcunlink(pg);
+    pcidle(pg, 1);
+    kdup(pg->data);
+    release(&pcache.lock);
+    return pg->data;
+  }
+
+  // Recycle the least recently used page that is not mapped.
+  for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev)
+    if(pg->data == 0 || krefs(pg->data) == 1)
+      break;
+  if(pg == &pcache.head || (pg->data == 0 && (pg->data = kalloc()) == 0)){
+    release(&pcache.lock);
+    return 0;
+  }
+  pcunlink(pg);
+  pcidle(pg, 1);
+  if(pg->ip)
+    pcunhash(pg);
+  pg->ip = ip;
+  pg->off = off;
+  pg->hnext = pcache.hash[PCHASH(ip, off)];
+  pcache.hash[PCHASH(ip, off)] = pg;
+  ip->npage++;
+  kdup(pg->data);
+  release(&pcache.lock);
+
+  // Holding ip's lock keeps others away until the page is read.
+  memset(pg->data, 0, PGSIZE);
+  readi(ip, pg->data, off, PGSIZE);
+  return pg->data;
+}
+
+// Copy the n bytes at src, just written to ip at offset off,
+// into ip's cached pages.  Called by writei.
+void
+pcupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *pg;
+  uint a, s, e;
+
+  acquire(&pcache.lock);
+  for(a = off - off%PGSIZE; a < off + n; a += PGSIZE){
+    if((pg = pcfind(ip, a)) == 0)
+      continue;
+    s = off > a ? off : a;
+    e = off + n < a + PGSIZE ? off + n : a + PGSIZE;
+    memmove(pg->data + (s - a), src + (s - off), e - s);
+  }
+  release(&pcache.lock);
+}
+
+// Forget the cached pages of ip, which is leaving the inode cache
+// or being freed.  No process can have them mapped.
+void
+pcpurge(struct inode *ip)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE && ip->npage > 0; pg++){
+    if(pg->ip != ip)
+      continue;
+    if(krefs(pg->data) != 1)
+      panic("pcpurge");
+    pcunhash(pg);
+    pcunlink(pg);
+    pcidle(pg, 0);
+  }
+  release(&pcache.lock);
+}
+
+// Return the VMA of p that contains address va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end != 0 && v->start <= va && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return the lowest address mapped by p, or USERTOP if none is.
+// The heap must stay below it.
+uint
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint base;
+
+  base = USERTOP;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end != 0 && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Is there no VMA of p overlapping start to end?
+static int
+vmaclear(struct proc *p, uint start, uint end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end != 0 && v->start < end && start < v->end)
+      return 0;
+  return 1;
+}
+
+// Map len bytes of file f, starting at page-aligned offset off,
+// into the current process with protection prot.
+// Returns the address of the mapping, or -1.
+int
+mmap(struct file *f, uint off, uint len, int prot)
+{
+  struct vma *v, *nv;
+  uint end, best;
+  int i, type;
+
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if(off % PGSIZE != 0 || len == 0 || len > USERTOP)
+    return -1;
+  if(prot & ~(PROT_READ|PROT_WRITE))
+    return -1;
+  ilock(f->ip);
+  type = f->ip->type;
+  iunlock(f->ip);
+  if(type != T_FILE)
+    return -1;
+  len = PGROUNDUP(len);
+
+  nv = 0;
+  for(v = proc->vma; v < &proc->vma[NVMA]; v++)
+    if(v->end == 0){
+      nv = v;
+      break;
+    }
+  if(nv == 0)
+    return -1;
+
+  // Take the highest free range above the heap: the top of
+  // the address space or just below some other mapping.
+  best = 0;
+  for(i = 0; i <= NVMA; i++){
+    if(i == NVMA)
+      end = USERTOP;
+    else if(proc->vma[i].end != 0)
+      end = proc->vma[i].start;
+    else
+      continue;
+    if(end < PGROUNDUP(proc->sz) + len || end - len <= best)
+      continue;
+    if(vmaclear(proc, end - len, end))
+      best = end - len;
+  }
+  if(best == 0)
+    return -1;
+
+  nv->start = best;
+  nv->end = best + len;
+  nv->prot = prot;
+  nv->f = filedup(f);
+  nv->off = off;
+  return best;
+}
+
+// Unmap the pages from start to end from p.
+static void
+vmaunmap(struct proc *p, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;  // skip to next page table
+    if(pte == 0 || !(*pte & PTE_P))
+      continue;
+    kfree(KADDR(PTE_ADDR(*pte)));
+    *pte = 0;
+  }
+  if(p == proc)
+    lcr3(PADDR(p->pgdir));  // flush TLB
+}
+
+// Unmap the len bytes at page-aligned address addr from p,
+// trimming or splitting the mappings they belong to.
+// Returns -1 if a split needs a VMA and there is none left.
+int
+munmap(struct proc *p, uint addr, uint len)
+{
+  struct vma *v, *w;
+  uint start, end;
+
+  if(addr % PGSIZE != 0 || addr >= USERTOP)
+    return -1;
+  if(len > USERTOP - addr)
+    len = USERTOP - addr;
+  end = PGROUNDUP(addr + len);
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end == 0 || v->end <= addr || end <= v->start)
+      continue;
+    start = addr > v->start ? addr : v->start;
+    if(start > v->start && end < v->end){
+      // Punching a hole: the part above it needs its own VMA.
+      for(w = p->vma; w < &p->vma[NVMA] && w->end != 0; w++)
+        ;
+      if(w == &p->vma[NVMA])
+        return -1;
+      *w = *v;
+      w->start = end;
+      w->off = v->off + (end - v->start);
+      filedup(w->f);
+      v->end = end;
+    }
+    if(end < v->end){
+      vmaunmap(p, start, end);
+      v->off += end - v->start;
+      v->start = end;
+    } else {
+      vmaunmap(p, start, v->end);
+      v->end = start;
+    }
+    if(v->start >= v->end){
+      fileclose(v->f);
+      v->f = 0;
+      v->start = v->end = 0;
+    }
+  }
+  return 0;
+}
+
+// Map the page of v containing va into p, which faulted on it
+// for a write if write is set.  Returns 0 on success.
+int
+vmafault(struct proc *p, struct vma *v, uint va, int write)
+{
+  struct inode *ip;
+  pte_t *pte;
+  char *data, *mem;
+
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  va = (uint)PGROUNDDOWN(va);
+  ip = v->f->ip;
+  if((pte = walkpgdir(p->pgdir, (char*)va, 1)) == 0)
+    return -1;
+
+  ilock(ip);
+  data = pcget(ip, v->off + (va - v->start));
+  iunlock(ip);
+  if(data == 0)
+    return -1;
+  if(write){
+    if((mem = kalloc()) == 0){
+      kfree(data);
+      return -1;
+    }
+    memmove(mem, data, PGSIZE);
+    kfree(data);
+    *pte = PADDR(mem) | PTE_P | PTE_W | PTE_U;
+  } else if(v->prot & PROT_WRITE)
+    *pte = PADDR(data) | PTE_P | PTE_COW | PTE_U;
+  else
+    *pte = PADDR(data) | PTE_P | PTE_U;
+  return 0;
+}
+
+// Copy p's mappings into np, for fork.
+// copyuvm has already shared their pages.
+void
+vmacopy(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    np->vma[v - p->vma] = *v;
+    if(v->end != 0)
+      filedup(v->f);
+  }
+}
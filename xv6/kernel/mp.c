@@ -8,6 +8,7 @@
 #include "mp.h"
 #include "x86.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "proc.h"
 
 struct cpu cpus[NCPU];
@@ -33,12 +34,13 @@ sum(uchar *addr, int len)
   return sum;
 }
 
-// Look for an MP structure in the len bytes at addr.
+// Look for an MP structure in the len bytes at physical address a.
 static struct mp*
-mpsearch1(uchar *addr, int len)
+mpsearch1(uint a, int len)
 {
-  uchar *e, *p;
+  uchar *e, *p, *addr;
 
+  addr = KADDR(a);
   e = addr+len;
   for(p = addr; p < e; p += sizeof(struct mp))
     if(memcmp(p, "_MP_", 4) == 0 && sum(p, sizeof(struct mp)) == 0)
@@ -58,16 +60,16 @@ mpsearch(void)
   uint p;
   struct mp *mp;
 
-  bda = (uchar*)0x400;
+  bda = KADDR(0x400);
   if((p = ((bda[0x0F]<<8)|bda[0x0E]) << 4)){
-    if((mp = mpsearch1((uchar*)p, 1024)))
+    if((mp = mpsearch1(p, 1024)))
       return mp;
   } else {
     p = ((bda[0x14]<<8)|bda[0x13])*1024;
-    if((mp = mpsearch1((uchar*)p-1024, 1024)))
+    if((mp = mpsearch1(p-1024, 1024)))
       return mp;
   }
-  return mpsearch1((uchar*)0xF0000, 0x10000);
+  return mpsearch1(0xF0000, 0x10000);
 }
 
 // Search for an MP configuration table.  For now,
@@ -83,7 +85,7 @@ mpconfig(struct mp **pmp)
 
   if((mp = mpsearch()) == 0 || mp->physaddr == 0)
     return 0;
-  conf = (struct mpconf*)mp->physaddr;
+  conf = (struct mpconf*)KADDR(mp->physaddr);
   if(memcmp(conf, "PCMP", 4) != 0)
     return 0;
   if(conf->version != 1 && conf->version != 4)
@@ -0,0 +1,52 @@
+// PCI configuration space access, using configuration mechanism #1.
+// Only enough to find a device by class and read or write its
+// configuration registers; there is no general bus enumeration.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFIG_ADDR  0xCF8
+#define PCI_CONFIG_DATA  0xCFC
+
+static uint
+pciaddr(uint bdf, int reg)
+{
+  return 0x80000000 | (bdf << 8) | (reg & 0xFC);
+}
+
+// Read the 32-bit configuration register reg of function bdf.
+uint
+pciconfread(uint bdf, int reg)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(bdf, reg));
+  return inl(PCI_CONFIG_DATA);
+}
+
+// Write the 32-bit configuration register reg of function bdf.
+void
+pciconfwrite(uint bdf, int reg, uint v)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(bdf, reg));
+  outl(PCI_CONFIG_DATA, v);
+}
+
+// Find the first function on bus 0 with the given class and subclass.
+// Returns its bus/device/function number (bus<<8 | dev<<3 | func)
+// or -1 if there is none.
+int
+pcifind(int class, int subclass)
+{
+  uint bdf, id, cls;
+
+  for(bdf = 0; bdf < 32*8; bdf++){
+    id = pciconfread(bdf, PCI_ID);
+    if((id & 0xFFFF) == 0xFFFF)
+      continue;
+    cls = pciconfread(bdf, PCI_CLASS);
+    if(((cls >> 24) & 0xFF) == class && ((cls >> 16) & 0xFF) == subclass)
+      return bdf;
+  }
+  return -1;
+}
@@ -0,0 +1,15 @@
+#ifndef _PCI_H_
+#define _PCI_H_
+// PCI configuration space registers.
+#define PCI_ID        0x00  // vendor and device id
+#define PCI_COMMAND   0x04  // command and status
+  #define PCI_CMD_IO     0x0001  // I/O space enable
+  #define PCI_CMD_MASTER 0x0004  // bus master enable
+#define PCI_CLASS     0x08  // class, subclass, prog if, revision
+#define PCI_BAR4      0x20  // base address register 4
+
+// Device classes.
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_IDE   0x01
+
+#endif // _PCI_H_
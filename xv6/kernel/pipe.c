@@ -4,8 +4,10 @@
 #include "mmu.h"
 #include "proc.h"
 #include "fs.h"
-#include "file.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "slab.h"
+#include "file.h"
 
 #define PIPESIZE 512
 
@@ -18,6 +20,14 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+static struct slab pipeslab;
+
+void
+pipeinit(void)
+{
+  slabinit(&pipeslab, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -27,7 +37,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = slaballoc(&pipeslab)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
@@ -46,7 +56,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(p)
-    kfree((char*)p);
+    slabfree(&pipeslab, p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -67,7 +77,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    slabfree(&pipeslab, p);
   } else
     release(&p->lock);
 }
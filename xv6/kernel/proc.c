@@ -107,14 +107,22 @@ int
 growproc(int n)
 {
   uint sz;
+  struct progseg *s;
   
   sz = proc->sz;
   if(n > 0){
-    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
+    // Pages are allocated when first touched (see pagefault),
+    // but refuse more than there is any chance of getting.
+    if(sz + n < sz || sz + n > vmabase(proc) || n/PGSIZE > kavail())
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
       return -1;
+    // Don't load the program into memory given back.
+    for(s = proc->seg; s < &proc->seg[NPROGSEG]; s++)
+      if(s->va + s->filesz > sz)
+        s->filesz = s->va < sz ? sz - s->va : 0;
   }
   proc->sz = sz;
   switchuvm(proc);
@@ -135,13 +143,14 @@ fork(void)
     return -1;
 
   // Copy process state from p.
-  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+  if((np->pgdir = copyuvm(proc->pgdir)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = proc->sz;
+  vmacopy(np, proc);
   np->parent = proc;
   *np->tf = *proc->tf;
 
@@ -152,6 +161,11 @@ fork(void)
     if(proc->ofile[i])
       np->ofile[i] = filedup(proc->ofile[i]);
   np->cwd = idup(proc->cwd);
+  if(proc->exe){
+    np->exe = idup(proc->exe);
+    iexec(np->exe, 1);
+  }
+  memmove(np->seg, proc->seg, sizeof(proc->seg));
  
   pid = np->pid;
   np->state = RUNNABLE;
@@ -179,8 +193,18 @@ exit(void)
     }
   }
 
+  // Drop mapped files.
+  munmap(proc, 0, USERTOP);
+
+  if(proc->exe)
+    iexec(proc->exe, -1);
+  begin_op();
   iput(proc->cwd);
+  if(proc->exe)
+    iput(proc->exe);
+  end_op();
   proc->cwd = 0;
+  proc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -320,8 +344,18 @@ yield(void)
 void
 forkret(void)
 {
+  static int first = 1;
+
   // Still holding ptable.lock from scheduler.
   release(&ptable.lock);
+
+  if(first){
+    // Some initialization functions must be run in the context
+    // of a regular process (e.g., they call sleep), and thus cannot
+    // be run from main().
+    first = 0;
+    fsinit(ROOTDEV);
+  }
   
   // Return to "caller", actually trapret (see allocproc).
 }
@@ -60,6 +60,22 @@ struct context {
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
+// A segment of a process's program file, loaded on demand (see exec.c).
+struct progseg {
+  uint va;                     // First address
+  uint filesz;                 // Bytes from the file; the rest is zero
+  uint off;                    // Offset in the program file
+};
+
+// A file mapped into a process's memory (see mmap.c).
+struct vma {
+  uint start;                  // First address, page aligned
+  uint end;                    // End address, page aligned; 0 if slot unused
+  int prot;                    // PROT_READ, PROT_WRITE
+  struct file *f;              // File mapped
+  uint off;                    // Offset in f of start
+};
+
 struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
@@ -73,6 +89,9 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Mapped files
+  struct inode *exe;           // Program file, to load pages from
+  struct progseg seg[NPROGSEG]; // Parts of exe to load
   char name[16];               // Process name (debugging)
 };
 
@@ -0,0 +1,167 @@
+// Slab allocator for small kernel objects.
+//
+// A struct slab is a cache of objects of one size.  It carves
+// slabs, blocks of 2^order pages from kallocn, into objects;
+// a slab starts with a header, found from any of its objects by
+// rounding down, since kallocn aligns blocks to their size.
+// Slabs with free objects are kept on a list; a slab whose
+// objects are all free goes back to kalloc, unless it is the
+// cache's only empty slab.
+//
+// Each CPU keeps up to SLABCPU free objects of each cache, so
+// slaballoc and slabfree usually need no lock; the CPU takes
+// or returns half that many at a time under the cache's lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "slab.h"
+
+#define SLABMAXORDER 3
+
+struct slabhdr {
+  struct slabhdr *next;  // cache's list of slabs with free objects
+  struct slabhdr *prev;
+  void *free;            // free objects, linked through their first word
+  uint inuse;            // objects allocated
+};
+
+#define SLABHDR ((sizeof(struct slabhdr) + 7) & ~7)
+
+// Set up cache c for objects of size bytes.
+void
+slabinit(struct slab *c, char *name, uint size)
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  if(c->size < sizeof(void*))
+    c->size = sizeof(void*);
+  // Use slabs big enough to waste little space at the end.
+  for(c->order = 0; c->order < SLABMAXORDER; c->order++)
+    if(((PGSIZE << c->order) - SLABHDR) / c->size >= 8)
+      break;
+  c->nobj = ((PGSIZE << c->order) - SLABHDR) / c->size;
+  if(c->nobj == 0)
+    panic("slabinit: object too big");
+  c->avail = 0;
+  c->nempty = 0;
+}
+
+static void
+slabunlink(struct slab *c, struct slabhdr *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->avail = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+slablink(struct slab *c, struct slabhdr *s)
+{
+  s->prev = 0;
+  s->next = c->avail;
+  if(c->avail)
+    c->avail->prev = s;
+  c->avail = s;
+}
+
+// Take a free object from c's slabs, making a new slab
+// if none has one.  Caller holds c->lock.
+static void*
+slabget(struct slab *c)
+{
+  struct slabhdr *s;
+  char *o;
+  uint i;
+
+  if((s = c->avail) == 0){
+    if((s = (struct slabhdr*)kallocn(c->order)) == 0)
+      return 0;
+    s->free = 0;
+    s->inuse = 0;
+    o = (char*)s + SLABHDR;
+    for(i = 0; i < c->nobj; i++, o += c->size){
+      *(void**)o = s->free;
+      s->free = o;
+    }
+    slablink(c, s);
+    c->nempty++;
+  }
+  o = s->free;
+  s->free = *(void**)o;
+  if(s->inuse++ == 0)
+    c->nempty--;
+  if(s->free == 0)
+    slabunlink(c, s);
+  return o;
+}
+
+// Give object o back to its slab.  Caller holds c->lock.
+static void
+slabput(struct slab *c, void *o)
+{
+  struct slabhdr *s;
+
+  s = (struct slabhdr*)((uint)o & ~((PGSIZE << c->order) - 1));
+  if(s->free == 0)
+    slablink(c, s);
+  *(void**)o = s->free;
+  s->free = o;
+  if(--s->inuse == 0){
+    if(c->nempty > 0){
+      slabunlink(c, s);
+      kfreen((char*)s, c->order);
+    } else
+      c->nempty++;
+  }
+}
+
+// Allocate a zeroed object from cache c.
+// Returns 0 if memory is short.
+void*
+slaballoc(struct slab *c)
+{
+  void *o;
+  int i;
+
+  pushcli();
+  i = cpu - cpus;
+  if(c->cpu[i].n == 0){
+    acquire(&c->lock);
+    while(c->cpu[i].n < SLABCPU/2 && (o = slabget(c)) != 0)
+      c->cpu[i].obj[c->cpu[i].n++] = o;
+    release(&c->lock);
+  }
+  o = 0;
+  if(c->cpu[i].n > 0)
+    o = c->cpu[i].obj[--c->cpu[i].n];
+  popcli();
+  if(o)
+    memset(o, 0, c->size);
+  return o;
+}
+
+// Free object o, allocated from cache c.
+void
+slabfree(struct slab *c, void *o)
+{
+  int i;
+
+  pushcli();
+  i = cpu - cpus;
+  if(c->cpu[i].n == SLABCPU){
+    acquire(&c->lock);
+    while(c->cpu[i].n > SLABCPU/2)
+      slabput(c, c->cpu[i].obj[--c->cpu[i].n]);
+    release(&c->lock);
+  }
+  c->cpu[i].obj[c->cpu[i].n++] = o;
+  popcli();
+}
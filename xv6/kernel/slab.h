@@ -0,0 +1,24 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+// Cache of same-sized kernel objects (see slab.c).
+// Needs spinlock.h and param.h.
+#define SLABCPU 8  // objects each CPU keeps at hand
+
+struct slabhdr;
+
+struct slab {
+  struct spinlock lock;
+  char *name;         // Name of cache, for debugging
+  uint size;          // Object size
+  int order;          // Slabs are 2^order pages
+  uint nobj;          // Objects per slab
+  struct slabhdr *avail; // Slabs with free objects
+  int nempty;         // Slabs with no objects in use
+  struct {
+    void *obj[SLABCPU];
+    int n;
+  } cpu[NCPU];        // Per-CPU free objects
+};
+
+#endif // _SLAB_H_
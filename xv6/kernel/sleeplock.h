@@ -0,0 +1,15 @@
+#ifndef _SLEEPLOCK_H_
+#define _SLEEPLOCK_H_
+
+// Long-term lock for processes.
+// Needs spinlock.h.
+struct sleeplock {
+  uint locked;       // Is the lock held?
+  struct spinlock lk; // spinlock protecting this sleep lock
+  
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding lock
+};
+
+#endif // _SLEEPLOCK_H_
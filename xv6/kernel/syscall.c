@@ -17,7 +17,7 @@
 int
 fetchint(struct proc *p, uint addr, int *ip)
 {
-  if(addr >= p->sz || addr+4 > p->sz)
+  if(uvmcheck(p, addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -31,14 +31,16 @@ fetchstr(struct proc *p, uint addr, char **pp)
 {
   char *s, *ep;
 
-  if(addr >= p->sz)
-    return -1;
   *pp = (char*)addr;
-  ep = (char*)p->sz;
-  for(s = *pp; s < ep; s++)
-    if(*s == 0)
-      return s - *pp;
-  return -1;
+  for(s = *pp; ; s = ep){
+    // Check a page at a time, so the string may end in a mapped file.
+    if(uvmcheck(p, (uint)s, 1, 0) < 0)
+      return -1;
+    ep = PGROUNDDOWN(s) + PGSIZE;
+    for(; s < ep; s++)
+      if(*s == 0)
+        return s - *pp;
+  }
 }
 
 // Fetch the nth 32-bit system call argument.
@@ -58,7 +60,22 @@ argptr(int n, char **pp, int size)
   
   if(argint(n, &i) < 0)
     return -1;
-  if((uint)i >= proc->sz || (uint)i+size > proc->sz)
+  if(size < 0 || uvmcheck(proc, i, size, 0) < 0)
+    return -1;
+  *pp = (char*)i;
+  return 0;
+}
+
+// Like argptr, but for a block the system call will write to,
+// which must not be read-only (such as a page of a mapped file).
+int
+argoutptr(int n, char **pp, int size)
+{
+  int i;
+
+  if(argint(n, &i) < 0)
+    return -1;
+  if(size < 0 || uvmcheck(proc, i, size, 1) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -66,8 +83,8 @@ argptr(int n, char **pp, int size)
 
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Apart from mapped files, there is no shared memory, so the
+// string can't change between this check and being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -103,6 +120,8 @@ static int (*syscalls[])(void) = {
 [SYS_wait]    sys_wait,
 [SYS_write]   sys_write,
 [SYS_uptime]  sys_uptime,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
 };
 
 // Called on a syscall trap. Checks that the syscall number (passed via eax)
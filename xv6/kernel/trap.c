@@ -75,7 +75,12 @@ trap(struct trapframe *tf)
             cpu->id, tf->cs, tf->eip);
     lapiceoi();
     break;
-   
+
+  case T_PGFLT:
+    if(proc && (tf->cs&3) == DPL_USER &&
+       pagefault(proc, rcr2(), tf->err & FEC_WR) == 0)
+      break;
+    // fall through
   default:
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
@@ -3,6 +3,7 @@
 #include "defs.h"
 #include "x86.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "proc.h"
 #include "elf.h"
 
@@ -10,14 +11,6 @@ extern char data[];  // defined in data.S
 
 static pde_t *kpgdir;  // for use in scheduler()
 
-// Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
-void
-kvmalloc(void)
-{
-  kpgdir = setupkvm();
-}
-
 // Set up CPU's kernel segment descriptors.
 // Run once at boot time on each CPU.
 void
@@ -49,7 +42,7 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to linear address va.  If create!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int create)
 {
   pde_t *pde;
@@ -57,7 +50,7 @@ walkpgdir(pde_t *pgdir, const void *va, int create)
 
   pde = &pgdir[PDX(va)];
   if(*pde & PTE_P){
-    pgtab = (pte_t*)PTE_ADDR(*pde);
+    pgtab = (pte_t*)KADDR(PTE_ADDR(*pde));
   } else {
     if(!create || (pgtab = (pte_t*)kalloc()) == 0)
       return 0;
@@ -74,7 +67,7 @@ walkpgdir(pde_t *pgdir, const void *va, int create)
 // Create PTEs for linear addresses starting at la that refer to
 // physical addresses starting at pa. la and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *la, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -106,49 +99,96 @@ mappages(pde_t *pgdir, void *la, uint size, uint pa, int perm)
 // than its memory.
 // 
 // setupkvm() and exec() set up every page table like this:
-//   0..640K          : user memory (text, data, stack, heap)
-//   640K..1M         : mapped direct (for IO space)
-//   1M..end          : mapped direct (for the kernel's text and data)
-//   end..PHYSTOP     : mapped direct (kernel heap and user pages)
-//   0xfe000000..0    : mapped direct (devices such as ioapic)
+//   0..USERTOP           : user memory (text, data, stack, heap)
+//   KERNBASE..+1M        : mapped to 0..1M (for IO space)
+//   KERNLINK..data       : mapped to 1M.. (for the kernel's text)
+//   data..KERNBASE+phystop : mapped to the rest of memory
+//                          (kernel data and heap, user pages)
+//   DEVSPACE..0          : mapped direct (devices such as ioapic)
 //
 // The kernel allocates memory for its heap and for user memory
-// between kernend and the end of physical memory (PHYSTOP).
+// between kernend and the end of physical memory (phystop, found
+// by kinit, at most PHYSMAX).
 // The virtual address space of each user program includes the kernel
 // (which is inaccessible in user mode).  The user program addresses
-// range from 0 till 640KB (USERTOP), which where the I/O hole starts
-// (both in physical memory and in the kernel's virtual address
-// space).
+// range from 0 till USERTOP, which is KERNBASE.
+// The kernel's mappings use 4 MB pages where they can, so most of
+// them need no page table pages.  The kernel part is built once,
+// in kpgdir, and never changes, so every other page table just
+// copies its page directory entries and shares its page tables.
 static struct kmap {
-  void *p;
-  void *e;
+  void *virt;
+  uint phys_start;
+  uint phys_end;
   int perm;
 } kmap[] = {
-  {(void*)USERTOP,    (void*)0x100000, PTE_W},  // I/O space
-  {(void*)0x100000,   data,            0    },  // kernel text, rodata
-  {data,              (void*)PHYSTOP,  PTE_W},  // kernel data, memory
-  {(void*)0xFE000000, 0,               PTE_W},  // device mappings
+  {(void*)KERNBASE, 0,           EXTMEM,      PTE_W},  // I/O space
+  {(void*)KERNLINK, EXTMEM,      PADDR(data), 0    },  // kernel text, rodata
+  {data,            PADDR(data), 0,           PTE_W},  // kernel data, memory
+  {(void*)DEVSPACE, DEVSPACE,    0,           PTE_W},  // device mappings
 };
 
-// Set up kernel part of a page table.
+// Map k into pgdir, with a 4 MB page for each aligned
+// 4 MB of it and 4 KB pages for the rest.
+static int
+kmappages(pde_t *pgdir, struct kmap *k)
+{
+  uint a, pa, n;
+
+  a = (uint)k->virt;
+  pa = k->phys_start;
+  for(n = k->phys_end - k->phys_start; n > 0; ){
+    if(a % SPGSIZE == 0 && pa % SPGSIZE == 0 && n >= SPGSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | k->perm | PTE_P | PTE_PS;
+      a += SPGSIZE;
+      pa += SPGSIZE;
+      n -= SPGSIZE;
+    } else {
+      if(mappages(pgdir, (void*)a, PGSIZE, pa, k->perm) < 0)
+        return -1;
+      a += PGSIZE;
+      pa += PGSIZE;
+      n -= PGSIZE;
+    }
+  }
+  return 0;
+}
+
+// Allocate one page table for the machine for the kernel address
+// space for scheduler processes.  Its kernel part is the one
+// every page table shares (see setupkvm).
+void
+kvmalloc(void)
+{
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  kmap[2].phys_end = phystop;  // known once kinit has run
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kmappages(kpgdir, k) < 0)
+      panic("kvmalloc");
+}
+
+// Set up kernel part of a page table, sharing kpgdir's.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  k = kmap;
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->p, k->e - k->p, (uint)k->p, k->perm) < 0)
-      return 0;
-
+  memset(pgdir, 0, PDX(KERNBASE)*sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE))*sizeof(pde_t));
   return pgdir;
 }
 
-// Turn on paging.
+// Switch to the kernel's page table; paging is already on,
+// with entrypgdir (see multiboot.S).
 void
 vmenable(void)
 {
@@ -156,7 +196,7 @@ vmenable(void)
 
   switchkvm(); // load kpgdir into cr3
   cr0 = rcr0();
-  cr0 |= CR0_PG;
+  cr0 |= CR0_WP;  // kernel writes to user pages obey PTE_W too
   lcr0(cr0);
 }
 
@@ -199,26 +239,38 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
+// Map a fresh page at va in p, on its first touch, holding
+// whatever part of p's program file belongs there (see exec).
+static int
+loaduvm(struct proc *p, uint va)
 {
-  uint i, pa, n;
+  struct progseg *s;
   pte_t *pte;
+  char *mem;
+  uint a, b;
 
-  if((uint)addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, (char*)pa, offset+i, n) != n)
-      return -1;
+  va = (uint)PGROUNDDOWN(va);
+  if((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(p->exe){
+    ilock(p->exe);
+    for(s = p->seg; s < &p->seg[NPROGSEG]; s++){
+      a = s->va > va ? s->va : va;
+      b = s->va + s->filesz < va + PGSIZE ? s->va + s->filesz : va + PGSIZE;
+      if(a < b && readi(p->exe, mem + (a - va), s->off + (a - s->va), b - a) != b - a){
+        iunlock(p->exe);
+        kfree(mem);
+        return -1;
+      }
+    }
+    iunlock(p->exe);
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
   }
   return 0;
 }
@@ -266,11 +318,13 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
     pte = walkpgdir(pgdir, (char*)a, 0);
-    if(pte && (*pte & PTE_P) != 0){
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;  // skip to next page table
+    else if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      kfree((char*)pa);
+      kfree(KADDR(pa));
       *pte = 0;
     }
   }
@@ -278,7 +332,7 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -287,73 +341,87 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, USERTOP, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(USERTOP); i++){
     if(pgdir[i] & PTE_P)
-      kfree((char*)PTE_ADDR(pgdir[i]));
+      kfree(KADDR(PTE_ADDR(pgdir[i])));
   }
   kfree((char*)pgdir);
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
+// Given the current process's page table, create a copy
+// of it for a child.  The two share every user page; writable
+// pages become read-only and copy-on-write in both (see pagefault).
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+  for(i = 0; i < USERTOP; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;  // skip to next page table
+      continue;
+    }
+    // Pages not yet loaded will be in the child too.
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, *pte & (PTE_U|PTE_COW)) < 0)
       goto bad;
+    kdup(KADDR(pa));
   }
+  lcr3(PADDR(pgdir));  // flush the parent's writable TLB entries
   return d;
 
 bad:
+  lcr3(PADDR(pgdir));
   freevm(d);
   return 0;
 }
 
-// Map user virtual address to kernel physical address.
+// Map user virtual address to kernel virtual address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  return (char*)PTE_ADDR(*pte);
+  return KADDR(PTE_ADDR(*pte));
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Pages of the current process not yet allocated, or shared
+// copy-on-write, are faulted in first; other page tables
+// must have the pages present and writable.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
   
+  if(proc && pgdir == proc->pgdir && uvmcheck(proc, va, len, 1) < 0)
+    return -1;
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(!(*pte & PTE_W))
+      return -1;
     n = PGSIZE - (va - va0);
     if(n > len)
       n = len;
@@ -364,3 +432,64 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   }
   return 0;
 }
+
+// Handle a fault by process p on user address va, for a write
+// if write is set, by mapping the page if p may use it.
+// Returns 0 if the page is now mapped, -1 if p had no business there.
+int
+pagefault(struct proc *p, uint va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  uint pa;
+
+  if(va >= USERTOP)
+    return -1;
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    if(!write || !(*pte & PTE_COW))
+      return -1;
+    // Copy on write: keep the page if no one else
+    // has it any more, otherwise take a private copy.
+    pa = PTE_ADDR(*pte);
+    if(krefs(KADDR(pa)) > 1){
+      if((mem = kalloc()) == 0)
+        return -1;
+      memmove(mem, KADDR(pa), PGSIZE);
+      kfree(KADDR(pa));
+      pa = PADDR(mem);
+    }
+    *pte = pa | PTE_P | PTE_W | PTE_U;
+    if(p == proc)
+      lcr3(PADDR(p->pgdir));  // flush TLB
+    return 0;
+  }
+  if(va < p->sz)
+    return loaduvm(p, va);
+  if((v = vmalookup(p, va)) != 0)
+    return vmafault(p, v, va, write);
+  return -1;
+}
+
+// Check that the len bytes at user address va are mapped in p,
+// and writable if write is set, faulting pages in as needed.
+// The kernel uses user addresses directly, so system calls
+// must check (through argptr and friends) before touching them.
+int
+uvmcheck(struct proc *p, uint va, uint len, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  if(va >= USERTOP || len > USERTOP - va)
+    return -1;
+  for(a = (uint)PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (*pte & PTE_U) && (!write || (*pte & PTE_W)))
+      continue;
+    if(pagefault(p, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
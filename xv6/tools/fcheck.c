@@ -11,8 +11,230 @@
 #include "types.h"
 #include "fs.h"
 
+// The block size comes from the image's superblock, so one fcheck
+// handles images made with any BSIZE.  All the fs.h macros derived
+// from BSIZE (IPB, BPB, DPB, NINDIRECT, ...) follow it.
+static uint bsize;
+#undef BSIZE
+#define BSIZE bsize
+
 #define BLOCK_SIZE (BSIZE)
 
+static uint fsflags;  // superblock feature flags (FS_*)
+
+// Extent-mapped inodes (FS_EXTENTS).
+
+// Call fn on each block used by extent-mapped inode ip: its data
+// blocks, its extent leaf blocks and its index block.  Blocks must
+// be below nblocks.
+void extent_blocks(struct dinode *ip, int nblocks, char *addr, void (*fn)(uint, void*), void *arg) {
+    struct extent *e;
+    struct extidx *x;
+    uint i, j, b;
+
+    e = (struct extent *)ip->addrs;
+    for (i = 0; i < NEXTENT && e[i].len; i++) {
+        if (e[i].start >= nblocks || e[i].len > nblocks - e[i].start) {
+            fprintf(stderr, "ERROR: bad extent address in inode.\n");
+            exit(1);
+        }
+        for (b = 0; b < e[i].len; b++)
+            fn(e[i].start + b, arg);
+    }
+    if (ip->addrs[EXTIDX] == 0)
+        return;
+    if (ip->addrs[EXTIDX] >= nblocks) {
+        fprintf(stderr, "ERROR: bad extent address in inode.\n");
+        exit(1);
+    }
+    fn(ip->addrs[EXTIDX], arg);
+    x = (struct extidx *)(addr + ip->addrs[EXTIDX] * BLOCK_SIZE);
+    for (j = 0; j < EPB && x[j].leaf; j++) {
+        if (x[j].leaf >= nblocks) {
+            fprintf(stderr, "ERROR: bad extent address in inode.\n");
+            exit(1);
+        }
+        fn(x[j].leaf, arg);
+        e = (struct extent *)(addr + x[j].leaf * BLOCK_SIZE);
+        for (i = 0; i < EPB && e[i].len; i++) {
+            if (e[i].start >= nblocks || e[i].len > nblocks - e[i].start) {
+                fprintf(stderr, "ERROR: bad extent address in inode.\n");
+                exit(1);
+            }
+            for (b = 0; b < e[i].len; b++)
+                fn(e[i].start + b, arg);
+        }
+    }
+}
+
+// What check_block checks about each block it is called on.
+struct block_check {
+    char *bitmap;        // if set, the block must be marked in use
+    const char *msg;     // error if it is not
+    uint *uses;          // if set, count uses of the block
+    const char *dupmsg;  // error if it is used more than once
+};
+
+void check_block(uint b, void *arg) {
+    struct block_check *c = arg;
+
+    if (c == NULL) return;
+    if (c->bitmap && !(c->bitmap[b / 8] & (1 << (b % 8)))) {
+        fprintf(stderr, "ERROR: %s\n", c->msg);
+        exit(1);
+    }
+    if (c->uses && ++c->uses[b] > 1) {
+        fprintf(stderr, "ERROR: %s\n", c->dupmsg);
+        exit(1);
+    }
+}
+
+// Call fn on the double-indirect block of ip, the indirect blocks it
+// lists and the blocks they list.  Blocks must be below nblocks.
+void dindirect_blocks(struct dinode *ip, int nblocks, char *addr, void (*fn)(uint, void*), void *arg) {
+    uint i, j, *a, *b;
+
+    if (ip->addrs[NDIRECT+1] == 0) return;
+    if (ip->addrs[NDIRECT+1] >= nblocks) {
+        fprintf(stderr, "ERROR: bad indirect address in inode.\n");
+        exit(1);
+    }
+    fn(ip->addrs[NDIRECT+1], arg);
+    a = (uint *)(addr + ip->addrs[NDIRECT+1] * BLOCK_SIZE);
+    for (i = 0; i < NINDIRECT; i++) {
+        if (a[i] == 0) continue;
+        if (a[i] >= nblocks) {
+            fprintf(stderr, "ERROR: bad indirect address in inode.\n");
+            exit(1);
+        }
+        fn(a[i], arg);
+        b = (uint *)(addr + a[i] * BLOCK_SIZE);
+        for (j = 0; j < NINDIRECT; j++) {
+            if (b[j] == 0) continue;
+            if (b[j] >= nblocks) {
+                fprintf(stderr, "ERROR: bad indirect address in inode.\n");
+                exit(1);
+            }
+            fn(b[j], arg);
+        }
+    }
+}
+
+// The address, bitmap and uniqueness checks for extent-mapped images.
+void check_extent_inodes(struct dinode *dip, char *bitmap, int ninodes, int nblocks, char *addr) {
+    uint uses[nblocks];
+    struct block_check c = {
+        bitmap, "address used by inode but marked free in bitmap.",
+        uses, "extent address used more than once."
+    };
+    int inum;
+
+    memset(uses, 0, sizeof(uint) * nblocks);
+    for (inum = 1; inum < ninodes; inum++) {
+        if (dip[inum].type == 0) continue;
+        extent_blocks(&dip[inum], nblocks, addr, check_block, &c);
+    }
+}
+
+// Return the address of file block bn of inode ip, or 0 if none.
+// Addresses must already have been checked.
+uint fbmap(struct dinode *ip, uint bn, char *addr) {
+    struct extent *e;
+    struct extidx *x;
+    uint i, j, lbn;
+
+    if (!(fsflags & FS_EXTENTS)) {
+        if (bn < NDIRECT)
+            return ip->addrs[bn];
+        bn -= NDIRECT;
+        if (bn < NINDIRECT)
+            return ip->addrs[NDIRECT] == 0 ? 0 :
+                ((uint *)(addr + ip->addrs[NDIRECT] * BLOCK_SIZE))[bn];
+        bn -= NINDIRECT;
+        if (bn >= NDINDIRECT || ip->addrs[NDIRECT+1] == 0)
+            return 0;
+        j = ((uint *)(addr + ip->addrs[NDIRECT+1] * BLOCK_SIZE))[bn / NINDIRECT];
+        return j == 0 ? 0 : ((uint *)(addr + j * BLOCK_SIZE))[bn % NINDIRECT];
+    }
+
+    e = (struct extent *)ip->addrs;
+    lbn = 0;
+    for (i = 0; i < NEXTENT && e[i].len; lbn += e[i].len, i++)
+        if (bn < lbn + e[i].len)
+            return e[i].start + bn - lbn;
+    if (ip->addrs[EXTIDX] == 0)
+        return 0;
+    x = (struct extidx *)(addr + ip->addrs[EXTIDX] * BLOCK_SIZE);
+    for (j = 0; j < EPB && x[j].leaf; j++) {
+        e = (struct extent *)(addr + x[j].leaf * BLOCK_SIZE);
+        for (i = 0; i < EPB && e[i].len; lbn += e[i].len, i++)
+            if (bn < lbn + e[i].len)
+                return e[i].start + bn - lbn;
+    }
+    return 0;
+}
+
+// Number of file blocks fbmap can be asked about for inode ip.
+uint fbmax(struct dinode *ip) {
+    if (fsflags & FS_EXTENTS)
+        return (ip->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return MAXFILE;
+}
+
+// Hashed directories (FS_HASHDIR).
+
+// Same hash as namehash in the kernel.
+uint namehash(char *name) {
+    uint h;
+    int i;
+
+    h = 0;
+    for (i = 0; i < DIRSIZ && name[i]; i++)
+        h = h * 31 + (uchar)name[i];
+    return h;
+}
+
+void bad_hashed_directory(void) {
+    fprintf(stderr, "ERROR: bad hashed directory.\n");
+    exit(1);
+}
+
+// Check the header and bucket chains of each hashed directory:
+// every chain block must be a bucket block of the directory that is
+// on no other chain, and every entry must be in its name's bucket.
+void check_hashed_directories(struct dinode *dip, int ninodes, char *addr) {
+    struct dirhash *h, *blk;
+    struct dirent *de;
+    uint nbucket, nblk, b, bn, i, inum;
+
+    for (inum = 1; inum < ninodes; inum++) {
+        struct dinode *inode = &dip[inum];
+        if (inode->type != T_DIR || inode->size <= BLOCK_SIZE) continue;
+        if (fbmap(inode, 1, addr) == 0) continue;
+        h = (struct dirhash *)(addr + fbmap(inode, 1, addr) * BLOCK_SIZE);
+        if (h->inum != 0 || h->w[0] != DIRMAGIC) continue;  // linear
+
+        nbucket = h->w[1];
+        if (nbucket == 0 || nbucket > NDIRBUCKET) bad_hashed_directory();
+        nblk = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        char seen[nblk];
+        memset(seen, 0, nblk);
+        for (b = 0; b < nbucket; b++) {
+            for (bn = h[1 + b / DHPS].w[b % DHPS]; bn != 0; bn = blk->w[1]) {
+                if (bn < 2 || bn >= nblk || seen[bn]++ || fbmap(inode, bn, addr) == 0)
+                    bad_hashed_directory();
+                blk = (struct dirhash *)(addr + fbmap(inode, bn, addr) * BLOCK_SIZE);
+                if (blk->inum != 0 || blk->w[0] != DIRMAGIC)
+                    bad_hashed_directory();
+                de = (struct dirent *)blk;
+                for (i = 1; i < DPB; i++)
+                    if (de[i].inum != 0 && namehash(de[i].name) % nbucket != b)
+                        bad_hashed_directory();
+            }
+        }
+    }
+}
+
 void check_inode_types(struct dinode *dip, int ninodes) {
   int i;
   for ( i = 0; i < ninodes; i++) {
@@ -57,6 +279,9 @@ void check_block_addresses(struct dinode *dip, int ninodes, int nblocks, char *a
                 }
             }
         }
+
+        // Check double-indirect block addresses
+        dindirect_blocks(inode, nblocks, addr, check_block, NULL);
     }
 }
 
@@ -86,12 +311,13 @@ void check_directory_format(struct dinode *dip, int ninodes, char *addr) {
         if (inode->type != T_DIR) continue;
 
         int pfound = 0, cfound = 0;
-        for ( i = 0; i < NDIRECT; i++) {
-            uint blockaddr = inode->addrs[i];
+        for ( i = 0; i < fbmax(inode); i++) {
+            uint blockaddr = fbmap(inode, i, addr);
             if (blockaddr == 0) continue;
 
             struct dirent *de = (struct dirent *)(addr + blockaddr * BLOCK_SIZE);
             for ( j = 0; j < DPB; j++, de++) {
+                if (de->inum == 0) continue;
                 if (!cfound && strcmp(".", de->name) == 0) {
                     cfound = 1;
                     if (de->inum != inum) {
@@ -155,44 +381,59 @@ void check_block_usage_in_bitmap(struct dinode *dip, char *bitmap, int ninodes,
         }
       }
     }
+
+    // Check double-indirect blocks
+    struct block_check c = { bitmap, "address used by inode but marked free in bitmap." };
+    dindirect_blocks(&dip[i], nblocks, fs_img, check_block, &c);
   }
 }
 
-void check_bitmap_consistency_with_inodes(struct dinode *dip, char *bitmap, int ninodes, int nblocks, void *img_ptr) {
-    int i, j, k;
-    uint *indirect;
-
-    // Iterate over all inodes
-    for (i = 0; i < ninodes; i++) {
-        if (dip[i].type == 0) {
-            continue; // Skip free inodes
-        }
+// Mark block b used in the array of use counts arg.
+void mark_block(uint b, void *arg) {
+    ((uint *)arg)[b] = 1;
+}
 
-        // Check direct blocks
-        for (j = 0; j < NDIRECT; j++) {
-            if (dip[i].addrs[j] != 0) {
-                if (!is_block_in_use(dip[i].addrs[j], bitmap)) {
-                    fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use.\n");
-                    exit(1);
-                }
-            }
+// Every block the bitmap marks in use must be file system metadata,
+// the log, or a block some inode uses.  Blocks reserved for a file
+// but not yet used must not be marked on disk, or a crash would
+// leak them.
+void check_bitmap_consistency_with_inodes(struct dinode *dip, char *bitmap, struct superblock *sb, void *img_ptr) {
+    uint used[sb->size];
+    uint b, i, j, k, *indirect;
+
+    memset(used, 0, sizeof(uint) * sb->size);
+    // Boot block, super block, inodes and bitmap, as laid out by mkfs.
+    for (b = 0; b < sb->ninodes / IPB + 3 + sb->size / BPB + 1 && b < sb->size; b++)
+        used[b] = 1;
+    for (b = sb->logstart; b < sb->logstart + sb->nlog && b < sb->size; b++)
+        used[b] = 1;
+
+    for (i = 1; i < sb->ninodes; i++) {
+        if (dip[i].type == 0)
+            continue;
+        if (fsflags & FS_EXTENTS) {
+            extent_blocks(&dip[i], sb->size, img_ptr, mark_block, used);
+            continue;
         }
-
-        // Check indirect blocks
-        if (dip[i].addrs[NDIRECT] != 0) {
+        for (j = 0; j < NDIRECT; j++)
+            if (dip[i].addrs[j] != 0 && dip[i].addrs[j] < sb->size)
+                used[dip[i].addrs[j]] = 1;
+        if (dip[i].addrs[NDIRECT] != 0 && dip[i].addrs[NDIRECT] < sb->size) {
+            used[dip[i].addrs[NDIRECT]] = 1;
             indirect = (uint *)(img_ptr + dip[i].addrs[NDIRECT] * BSIZE);
-            for (k = 0; k < NINDIRECT; k++) {
-                if (indirect[k] != 0) {
-                    if (!is_block_in_use(indirect[k], bitmap)) {
-                        fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use.\n");
-                        exit(1);
-                    }
-                }
-            }
+            for (k = 0; k < NINDIRECT; k++)
+                if (indirect[k] != 0 && indirect[k] < sb->size)
+                    used[indirect[k]] = 1;
         }
+        dindirect_blocks(&dip[i], sb->size, img_ptr, mark_block, used);
     }
 
-
+    for (b = 0; b < sb->size; b++) {
+        if (is_block_in_use(b, bitmap) && !used[b]) {
+            fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use.\n");
+            exit(1);
+        }
+    }
 }
 
 int is_block_in_use(uint block, char *bitmap) {
@@ -230,11 +471,15 @@ void check_indirect_address_uniqueness(struct dinode *dip, int ninodes, int nblo
     uint iuaddrs[nblocks];
     memset(iuaddrs, 0, sizeof(uint) * nblocks);
     int i,inum;
+    struct block_check c = { NULL, NULL, iuaddrs, "indirect address used more than once." };
 
     for ( inum = 1; inum < ninodes; inum++) {
         struct dinode *inode = &dip[inum];
         if (inode->type == 0) continue;
 
+        // Blocks under the double-indirect block count as indirect
+        dindirect_blocks(inode, nblocks, addr, check_block, &c);
+
         uint blockaddr = inode->addrs[NDIRECT];
         if (blockaddr == 0) continue;
 
@@ -257,14 +502,12 @@ void check_indirect_address_uniqueness(struct dinode *dip, int ninodes, int nblo
 void traverse_dirs(char *addr, struct dinode *rootinode, int *inodemap, struct dinode *dip) {
     int i, j;
     uint blockaddr;
-    uint *indirect;
     struct dinode *inode;
     struct dirent *dir;
 
     if (rootinode->type == T_DIR) {
-        // Traverse direct addresses
-        for (i = 0; i < NDIRECT; i++) {
-            blockaddr = rootinode->addrs[i];
+        for (i = 0; i < fbmax(rootinode); i++) {
+            blockaddr = fbmap(rootinode, i, addr);
             if (blockaddr == 0) continue;
 
             dir = (struct dirent *)(addr + blockaddr * BLOCK_SIZE);
@@ -277,26 +520,6 @@ void traverse_dirs(char *addr, struct dinode *rootinode, int *inodemap, struct d
                 }
             }
         }
-
-        // Traverse indirect addresses
-        blockaddr = rootinode->addrs[NDIRECT];
-        if (blockaddr != 0) {
-            indirect = (uint *)(addr + blockaddr * BLOCK_SIZE);
-            for (i = 0; i < NINDIRECT; i++, indirect++) {
-                blockaddr = *(indirect);
-                if (blockaddr == 0) continue;
-
-                dir = (struct dirent *)(addr + blockaddr * BLOCK_SIZE);
-                for (j = 0; j < DPB; j++, dir++) {
-                    if (dir->inum != 0 && strcmp(dir->name, ".") != 0 && strcmp(dir->name, "..") != 0) {
-                        inode = &dip[dir->inum];
-                        inodemap[dir->inum]++;
-                        // Recursion
-                        traverse_dirs(addr, inode, inodemap, dip);
-                    }
-                }
-            }
-        }
     }
 }
 
@@ -344,14 +567,33 @@ void directory_check(struct dinode *dip, int ninodes, int nblocks, char *addr) {
         }
     }
 }
+// Find the block size of the image: the superblock is block 1 and
+// records its own size.  Larger sizes are tried first, since for them
+// offset 512 lies in the unused, zeroed block 0.
+uint find_block_size(char *addr, off_t imgsize) {
+    struct superblock *sb;
+    uint b;
+
+    for (b = 4096; b > SECTSIZE; b /= 2) {
+        if (2 * b > imgsize) continue;
+        sb = (struct superblock *)(addr + b);
+        if (sb->bsize == b && (off_t)sb->size * b <= imgsize)
+            return b;
+    }
+    sb = (struct superblock *)(addr + SECTSIZE);
+    if (sb->bsize == SECTSIZE || sb->bsize == 0)
+        return SECTSIZE;
+    return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
-  int r,i,n,fsfd;
+  int fsfd;
   char *addr;
   struct dinode *dip;
   struct superblock *sb;
-  struct dirent *de;
+  struct stat st;
 
   if(argc < 2){
     fprintf(stderr, "image not found.\n");
@@ -365,27 +607,41 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  /* Dont hard code the size of file. Use fstat to get the size */
-  addr = mmap(NULL, 524248, PROT_READ, MAP_PRIVATE, fsfd, 0);
+  if(fstat(fsfd, &st) < 0){
+    perror("fstat");
+    exit(1);
+  }
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fsfd, 0);
   if (addr == MAP_FAILED){
 	perror("mmap failed");
 	exit(1);
   }
+  if((bsize = find_block_size(addr, st.st_size)) == 0){
+    fprintf(stderr, "ERROR: bad superblock.\n");
+    exit(1);
+  }
   /* read the super block */
   sb = (struct superblock *) (addr + 1 * BLOCK_SIZE);
+  fsflags = sb->flags;
   dip = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE); 
-  de = (struct dirent *) (addr + (dip[ROOTINO].addrs[0])*BLOCK_SIZE);
-  n = dip[ROOTINO].size/sizeof(struct dirent);
 
 
   check_inode_types(dip, sb->ninodes);
-  check_block_addresses(dip, sb->ninodes, sb->nblocks, addr);
-  check_root_directory(dip, (struct dirent *)(addr + (dip[ROOTINO].addrs[0])*BLOCK_SIZE));
+  if (fsflags & FS_EXTENTS) {
+    check_extent_inodes(dip, addr + BBLOCK(0, sb->ninodes) * BLOCK_SIZE, sb->ninodes, sb->nblocks, addr);
+  } else {
+    check_block_addresses(dip, sb->ninodes, sb->nblocks, addr);
+  }
+  check_root_directory(dip, (struct dirent *)(addr + fbmap(&dip[ROOTINO], 0, addr)*BLOCK_SIZE));
   check_directory_format(dip, sb->ninodes, addr);
-  check_block_usage_in_bitmap(dip, addr + BBLOCK(0, sb->ninodes) * BLOCK_SIZE, sb->ninodes, sb->nblocks, addr);
-  check_bitmap_consistency_with_inodes(dip, addr + BBLOCK(0, sb->ninodes) * BLOCK_SIZE, sb->ninodes, sb->nblocks, addr);
-  check_direct_address_uniqueness(dip, sb->ninodes, sb->nblocks,addr);
-  check_indirect_address_uniqueness(dip, sb->ninodes, sb->nblocks, addr);
+  if (fsflags & FS_HASHDIR)
+    check_hashed_directories(dip, sb->ninodes, addr);
+  if (!(fsflags & FS_EXTENTS)) {
+    check_block_usage_in_bitmap(dip, addr + BBLOCK(0, sb->ninodes) * BLOCK_SIZE, sb->ninodes, sb->nblocks, addr);
+    check_direct_address_uniqueness(dip, sb->ninodes, sb->nblocks,addr);
+    check_indirect_address_uniqueness(dip, sb->ninodes, sb->nblocks, addr);
+  }
+  check_bitmap_consistency_with_inodes(dip, addr + BBLOCK(0, sb->ninodes) * BLOCK_SIZE, sb, addr);
   directory_check(dip, sb->ninodes, sb->nblocks, addr);
   exit(0);
 
@@ -14,18 +14,23 @@
 #include "types.h"
 #include "fs.h"
 #include "stat.h"
+#include "param.h"
 #undef stat
 #undef dirent
 
-#define BLOCK_SIZE (512)
+#define BLOCK_SIZE (BSIZE)
+#define NDHB (BSIZE / sizeof(struct dirhash))  // DPB, but for xv6 dirents
 
-int nblocks = 995;
+int nblocks;
+int nlog = LOGSIZE + 1;  // header and data blocks, at the end of the disk
 int ninodes = 200;
 int size = 1024;
+int extents;  // -e: map files by extents
+int hashdir;  // -h: hash directories that outgrow a block
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -39,6 +44,10 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dappend(uint inum, struct xv6_dirent *de);
+uint bmap(struct dinode *din, uint fbn);
+uint emap(struct dinode *din, uint fbn);
+uint ientry(uint bn, uint i);
 
 // convert to intel byte order
 ushort
@@ -65,25 +74,30 @@ xint(uint x)
 
 
 int 
-mkfs(int nblocks, int ninodes, int size) {
+mkfs(int ninodes, int size) {
 
   int i;
   char buf[BLOCK_SIZE];
 
-  sb.size = xint(size);
-  sb.nblocks = xint(nblocks); // so whole disk is size sectors
-  sb.ninodes = xint(ninodes);
-
-  bitblocks = size/(512*8) + 1;
+  bitblocks = size/BPB + 1;
   usedblocks = ninodes / IPB + 3 + bitblocks;
   freeblock = usedblocks;
+  nblocks = size - usedblocks - nlog;
+
+  sb.size = xint(size);
+  sb.nblocks = xint(nblocks); // so whole disk is size blocks
+  sb.ninodes = xint(ninodes);
+  sb.bsize = xint(BSIZE);
+  sb.flags = xint((extents ? FS_EXTENTS : 0) | (hashdir ? FS_HASHDIR : 0));
+  sb.logstart = xint(size - nlog);
+  sb.nlog = xint(nlog);
 
-  printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
+  printf("used %d (bit %d ninode %zu) log %d free %u total %d\n", usedblocks,
+         bitblocks, ninodes/IPB + 1, nlog, freeblock, nblocks+usedblocks+nlog);
 
-  assert(nblocks + usedblocks == size);
+  assert(nblocks + usedblocks + nlog == size);
 
-  for(i = 0; i < nblocks + usedblocks; i++)
+  for(i = 0; i < size; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -181,14 +195,14 @@ add_dir(DIR *cur_dir, int cur_inode, int parent_inode) {
 
 		de.inum = xshort(child_inode);
 		strncpy(de.name, entry->d_name, DIRSIZ);
-		iappend(cur_inode, &de, sizeof(de));
+		dappend(cur_inode, &de);
 
 	}
 
 	// fix size of inode cur_dir
 	rinode(cur_inode, &din);
 	off = xint(din.size);
-	off = ((off/BSIZE) + 1) * BSIZE;
+	off = ((off + BSIZE - 1) / BSIZE) * BSIZE;
 	din.size = xint(off);
 	winode(cur_inode, &din);
 	return 0;
@@ -203,13 +217,22 @@ main(int argc, char *argv[])
   int r;
   DIR *root_dir;
 
+  for(; argc > 1 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-e") == 0)
+      extents = 1;
+    else if(strcmp(argv[1], "-h") == 0)
+      hashdir = 1;
+    else
+      break;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] [-h] fs.img files...\n");
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct xv6_dirent)) == 0);
+  assert((BSIZE % SECTSIZE) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct xv6_dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -217,7 +240,7 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  mkfs(995, 200, 1024);
+  mkfs(ninodes, size);
 
   root_dir = opendir(argv[2]);
 
@@ -237,11 +260,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -256,7 +279,7 @@ i2b(uint inum)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -270,7 +293,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -283,11 +306,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -310,61 +333,95 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < BPB);
+  bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
+  // The log lives at the end of the disk, marked in use.
+  assert(size <= BPB);
+  for(i = size - nlog; i < size; i++){
+    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  }
   printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3);
   wsect(ninodes / IPB + 3, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of indirect block bn, allocating a block for it
+// if necessary.
+uint
+ientry(uint bn, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  // printf("read indirect block\n");
+  rsect(bn, (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    usedblocks++;
+    wsect(bn, (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
+// Return the block holding file block fbn of din, allocating
+// it if necessary.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint x;
+
+  if(extents)
+    return emap(din, fbn);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+      usedblocks++;
+    }
+    return xint(din->addrs[fbn]);
+  }
+  if(fbn < NDIRECT + NINDIRECT){
+    if(xint(din->addrs[NDIRECT]) == 0){
+      // printf("allocate indirect block\n");
+      din->addrs[NDIRECT] = xint(freeblock++);
+      usedblocks++;
+    }
+    return ientry(xint(din->addrs[NDIRECT]), fbn - NDIRECT);
+  }
+  assert(fbn < MAXFILE);
+  if(xint(din->addrs[NDIRECT+1]) == 0){
+    din->addrs[NDIRECT+1] = xint(freeblock++);
+    usedblocks++;
+  }
+  x = fbn - NDIRECT - NINDIRECT;
+  return ientry(ientry(xint(din->addrs[NDIRECT+1]), x / NINDIRECT),
+                x % NINDIRECT);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
-  uint indirect[NINDIRECT];
+  char buf[BSIZE];
   uint x;
 
   rinode(inum, &din);
 
   off = xint(din.size);
   while(n > 0){
-    fbn = off / 512;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
-      }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    fbn = off / BSIZE;
+    x = bmap(&din, fbn);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -373,3 +430,144 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Return the block holding file block fbn of an extent-mapped inode,
+// allocating it if fbn is just past the end of the file.
+// Same layout as emap in the kernel.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent *e, *last;
+  struct extent leaf[EPB];
+  struct extidx idx[EPB];
+  uint i, j, lbn, b, next;
+
+  e = (struct extent*)din->addrs;
+  last = 0;
+  lbn = 0;
+  for(i = 0; i < NEXTENT && xint(e[i].len); i++){
+    if(fbn < lbn + xint(e[i].len))
+      return xint(e[i].start) + fbn - lbn;
+    lbn += xint(e[i].len);
+    last = &e[i];
+  }
+
+  j = 0;
+  if(xint(din->addrs[EXTIDX])){
+    rsect(xint(din->addrs[EXTIDX]), idx);
+    while(j+1 < EPB && xint(idx[j+1].leaf) && xint(idx[j+1].lbn) <= fbn)
+      j++;
+    rsect(xint(idx[j].leaf), leaf);
+    e = leaf;
+    lbn = xint(idx[j].lbn);
+    for(i = 0; i < EPB && xint(e[i].len); i++){
+      if(fbn < lbn + xint(e[i].len))
+        return xint(e[i].start) + fbn - lbn;
+      lbn += xint(e[i].len);
+      last = &e[i];
+    }
+  }
+  assert(fbn == lbn);
+
+  b = freeblock++;
+  usedblocks++;
+  if(last && b == xint(last->start) + xint(last->len)){
+    last->len = xint(xint(last->len) + 1);
+  } else if(i < (e == leaf ? EPB : NEXTENT)){
+    e[i].start = xint(b);
+    e[i].len = xint(1);
+  } else {
+    // Start a new leaf, and the index block if there is none.
+    if(xint(din->addrs[EXTIDX]) == 0){
+      din->addrs[EXTIDX] = xint(freeblock++);
+      usedblocks++;
+      bzero(idx, sizeof(idx));
+      next = 0;
+    } else
+      next = j + 1;
+    assert(next < EPB);
+    idx[next].lbn = xint(fbn);
+    idx[next].leaf = xint(freeblock++);
+    usedblocks++;
+    wsect(xint(din->addrs[EXTIDX]), idx);
+    e = leaf;
+    bzero(leaf, sizeof(leaf));
+    leaf[0].start = xint(b);
+    leaf[0].len = xint(1);
+    j = next;
+  }
+  if(e == leaf)
+    wsect(xint(idx[j].leaf), leaf);
+  return b;
+}
+
+// Same hash as namehash in the kernel.
+uint
+namehash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return h;
+}
+
+// Add entry de to directory inum.  With -h, a directory whose
+// first block is full is hashed the way dirlink in the kernel
+// does it; see fs.h.
+void
+dappend(uint inum, struct xv6_dirent *de)
+{
+  struct dinode din;
+  struct dirhash blk[NDHB];
+  uint off, b, bn, last, i, x;
+
+  rinode(inum, &din);
+  off = xint(din.size);
+  if(!hashdir || off < BSIZE){
+    iappend(inum, de, sizeof(*de));
+    return;
+  }
+  if(off == BSIZE){
+    bzero(blk, sizeof(blk));
+    blk[0].w[0] = xshort(DIRMAGIC);
+    blk[0].w[1] = xshort(NDIRBUCKET);
+    iappend(inum, blk, sizeof(blk));
+    rinode(inum, &din);
+  }
+  assert(off % BSIZE == 0);
+
+  // Look for a free entry in the bucket's chain.
+  b = namehash(de->name) % NDIRBUCKET;
+  rsect(bmap(&din, 1), blk);
+  bn = xshort(blk[1 + b/DHPS].w[b%DHPS]);
+  for(last = 0; bn != 0; last = bn, bn = xshort(blk[0].w[1])){
+    x = bmap(&din, bn);
+    rsect(x, blk);
+    for(i = 1; i < NDHB; i++){
+      if(blk[i].inum == 0){
+        memmove(&blk[i], de, sizeof(*de));
+        wsect(x, blk);
+        return;
+      }
+    }
+  }
+
+  // Start a new block and link it into the chain.
+  bn = xint(din.size) / BSIZE;
+  assert(bn <= 0xffff);
+  bzero(blk, sizeof(blk));
+  blk[0].w[0] = xshort(DIRMAGIC);
+  memmove(&blk[1], de, sizeof(*de));
+  iappend(inum, blk, sizeof(blk));
+  rinode(inum, &din);
+  x = bmap(&din, last == 0 ? 1 : last);
+  rsect(x, blk);
+  if(last == 0)
+    blk[1 + b/DHPS].w[b%DHPS] = xshort(bn);
+  else
+    blk[0].w[1] = xshort(bn);
+  wsect(x, blk);
+}
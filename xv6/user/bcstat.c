@@ -0,0 +1,53 @@
+// Print buffer cache and disk queue statistics.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "bcstat.h"
+
+// Integer percentage of a out of a+b.
+int
+pct(uint a, uint b)
+{
+  if(a + b == 0)
+    return 0;
+  return a * 100 / (a + b);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bcstat st;
+  uint n;
+  int fd, i;
+
+  fd = open("/dev/bcstat", O_RDONLY);
+  if(fd < 0 || read(fd, &st, sizeof(st)) != sizeof(st)){
+    printf(2, "bcstat: cannot read /dev/bcstat\n");
+    exit();
+  }
+  close(fd);
+
+  printf(1, "bcache: %d bufs, %d hits, %d misses (%d%% hit), "
+         "%d evictions, %d waits\n", st.nbuf, st.hits, st.misses,
+         pct(st.hits, st.misses), st.evictions, st.waits);
+  for(i = 0; i < BCSTAT_NREGION; i++){
+    if(st.rhits[i] + st.rmisses[i] == 0)
+      continue;
+    printf(1, "  blocks %d-", i * BCSTAT_REGION);
+    if(i < BCSTAT_NREGION - 1)
+      printf(1, "%d", (i+1) * BCSTAT_REGION - 1);
+    printf(1, ": %d hits, %d misses (%d%% hit)\n",
+           st.rhits[i], st.rmisses[i], pct(st.rhits[i], st.rmisses[i]));
+  }
+
+  n = st.ide_nreq ? st.ide_nreq : 1;
+  printf(1, "ide: %d reqs, depth %d max %d avg %d, "
+         "seek avg %d, %d sweeps\n", st.ide_nreq, st.ide_depth,
+         st.ide_maxdepth, st.ide_sumdepth / n, st.ide_seeks / n,
+         st.ide_sweeps);
+  printf(1, "  latency (kcycles): queue avg %d, service avg %d, max %d\n",
+         st.ide_qtime / n, st.ide_svctime / n, st.ide_maxtime);
+  exit();
+}
@@ -4,6 +4,8 @@
 #include "stat.h"
 #include "user.h"
 #include "fcntl.h"
+#include "bcstat.h"
+#include "memstat.h"
 
 char *argv[] = { "sh", 0 };
 
@@ -19,6 +21,12 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // Statistics devices, for bcstat, memstat and usertests.
+  // These fail harmlessly if the nodes are already there.
+  mkdir("/dev");
+  mknod("/dev/bcstat", BCSTAT, 0);
+  mknod("/dev/memstat", MEMSTAT, 0);
+
   for(;;){
     printf(1, "init: starting sh\n");
     pid = fork();
@@ -1,6 +1,7 @@
 
 # user programs
 USER_PROGS := \
+	bcstat\
 	cat\
 	echo\
 	forktest\
@@ -9,6 +10,7 @@ USER_PROGS := \
 	kill\
 	ln\
 	ls\
+	memstat\
 	mkdir\
 	rm\
 	sh\
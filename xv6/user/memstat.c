@@ -0,0 +1,42 @@
+// Print physical page allocator statistics.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "memstat.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  uint n;
+  int fd, k, big;
+
+  fd = open("/dev/memstat", O_RDONLY);
+  if(fd < 0 || read(fd, &st, sizeof(st)) != sizeof(st)){
+    printf(2, "memstat: cannot read /dev/memstat\n");
+    exit();
+  }
+  close(fd);
+
+  printf(1, "pages: %d total, %d free (%d in per-cpu caches)\n",
+         st.npage, st.nfree, st.ncached);
+  big = 0;
+  printf(1, "free blocks by order:");
+  for(k = 0; k < MEMSTAT_NORDER; k++){
+    printf(1, " %d", st.nblock[k]);
+    if(st.nblock[k])
+      big = k;
+  }
+  printf(1, "\n");
+
+  // Fragmentation: the share of free memory in the buddy
+  // lists that is not in blocks of the largest free size.
+  n = st.nfree - st.ncached;
+  printf(1, "largest free block %d pages, fragmentation %d%%\n",
+         n ? 1 << big : 0, n ? 100 - (st.nblock[big] << big) * 100 / n : 0);
+  printf(1, "%d splits, %d merges, %d failures\n",
+         st.nsplit, st.nmerge, st.nfail);
+  exit();
+}
@@ -1,13 +1,16 @@
 #include "types.h"
+#include "param.h"
 #include "stat.h"
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "mman.h"
 #include "syscall.h"
 #include "traps.h"
+#include "memstat.h"
 
 #define PAGE (4096)
-#define MAX_PROC_MEM (640 * 1024)
+#define BIG (4 * 1024 * 1024)
 
 char buf[2048];
 char name[3];
@@ -85,6 +88,11 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Number of 512-byte writes in the big file test: enough to
+// reach the double-indirect blocks with 512-byte blocks, but
+// well within the disk.
+#define NBIGWRITE 400
+
 void
 writetest1(void)
 {
@@ -98,7 +106,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIGWRITE; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -118,7 +126,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIGWRITE){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -201,6 +209,26 @@ exectest(void)
   }
 }
 
+// a running program's file can be read but not written,
+// since its pages are loaded from the file as they are used
+void
+txtbusy(void)
+{
+  int fd;
+
+  printf(stdout, "txtbusy test\n");
+  if(open("usertests", O_RDWR) >= 0 || open("usertests", O_WRONLY) >= 0){
+    printf(stdout, "opened running program for writing\n");
+    exit();
+  }
+  if((fd = open("usertests", 0)) < 0){
+    printf(stdout, "open running program for reading failed\n");
+    exit();
+  }
+  close(fd);
+  printf(stdout, "txtbusy ok\n");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -787,6 +815,61 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// a new directory that grows past its first block, which makes
+// it a hashed directory on a file system made with mkfs -h
+void
+bigsubdir(void)
+{
+  int i, fd;
+  char name[10];
+
+  printf(1, "bigsubdir test\n");
+  if(mkdir("bsd") != 0){
+    printf(1, "bigsubdir mkdir failed\n");
+    exit();
+  }
+  fd = open("bsd/f", O_CREATE);
+  if(fd < 0){
+    printf(1, "bigsubdir create failed\n");
+    exit();
+  }
+  close(fd);
+
+  name[0] = 'b';
+  name[1] = 's';
+  name[2] = 'd';
+  name[3] = '/';
+  name[4] = 'x';
+  name[7] = '\0';
+  for(i = 0; i < 600; i++){
+    name[5] = '0' + (i / 64);
+    name[6] = '0' + (i % 64);
+    if(link("bsd/f", name) != 0){
+      printf(1, "bigsubdir link %d failed\n", i);
+      exit();
+    }
+  }
+  for(i = 0; i < 600; i++){
+    name[5] = '0' + (i / 64);
+    name[6] = '0' + (i % 64);
+    if((fd = open(name, 0)) < 0){
+      printf(1, "bigsubdir open %d failed\n", i);
+      exit();
+    }
+    close(fd);
+    if(unlink(name) != 0){
+      printf(1, "bigsubdir unlink %d failed\n", i);
+      exit();
+    }
+  }
+  if(unlink("bsd/f") != 0 || unlink("bsd") != 0){
+    printf(1, "bigsubdir cleanup failed\n");
+    exit();
+  }
+
+  printf(1, "bigsubdir ok\n");
+}
+
 void
 subdir(void)
 {
@@ -1240,7 +1323,7 @@ forktest(void)
 void
 sbrktest(void)
 {
-  int fds[2], pid, pids[32], ppid;
+  int fds[2], pid, ppid, got[2];
   char *a, *b, *c, *lastaddr, *oldbrk, *p, scratch;
   uint amt;
 
@@ -1274,21 +1357,21 @@ sbrktest(void)
     exit();
   wait();
 
-  // can one allocate the full 640K?
+  // can one grow well past 640K?
   a = sbrk(0);
-  amt = (640 * 1024) - (uint)a;
+  amt = BIG - (uint)a;
   p = sbrk(amt);
   if(p != a){
-    printf(stdout, "sbrk test failed 640K test, p %x a %x\n", p, a);
+    printf(stdout, "sbrk test failed big test, p %x a %x\n", p, a);
     exit();
   }
-  lastaddr = (char*)(640 * 1024 - 1);
+  lastaddr = (char*)(BIG - 1);
   *lastaddr = 99;
 
-  // is one forbidden from allocating more than 640K?
-  c = sbrk(4096);
+  // is one forbidden from growing into the kernel?
+  c = sbrk(USERTOP - BIG + 4096);
   if(c != (char*)0xffffffff){
-    printf(stdout, "sbrk allocated more than 640K, c %x\n", c);
+    printf(stdout, "sbrk allocated past USERTOP, c %x\n", c);
     exit();
   }
 
@@ -1318,14 +1401,8 @@ sbrktest(void)
     exit();
   }
 
-  c = sbrk(4096);
-  if(c != (char*)0xffffffff){
-    printf(stdout, "sbrk was able to re-allocate beyond 640K, c %x\n", c);
-    exit();
-  }
-
   // can we read the kernel's memory?
-  for(a = (char*)(640*1024); a < (char*)2000000; a += 50000){
+  for(a = (char*)USERTOP; a < (char*)USERTOP + 2000000; a += 50000){
     ppid = getpid();
     pid = fork();
     if(pid < 0){
@@ -1340,51 +1417,41 @@ sbrktest(void)
     wait();
   }
 
-  // if we run the system out of memory, does it clean up the last
-  // failed allocation?
+  // if a process runs the system out of memory, does it give all
+  // of it back when it dies?  Each child touches pages until sbrk
+  // refuses (or a fault finds no memory and kills it), reporting
+  // every 64 pages; the second should get about as many as the first.
   sbrk(-(sbrk(0) - oldbrk));
-  if(pipe(fds) != 0){
-    printf(1, "pipe() failed\n");
-    exit();
-  }
-  for(i = 0; i < sizeof(pids)/sizeof(pids[0]); i++){
-    if((pids[i] = fork()) == 0){
-      // allocate the full 640K - 1 page
-      sbrk(MAX_PROC_MEM - (1 * PAGE) - (uint)sbrk(0));
-      write(fds[1], "x", 1);
+  for(i = 0; i < 2; i++){
+    if(pipe(fds) != 0){
+      printf(1, "pipe() failed\n");
+      exit();
+    }
+    if((pid = fork()) == 0){
+      close(fds[0]);
+      for(amt = 1; (c = sbrk(PAGE)) != (char*)0xffffffff; amt++){
+        *c = 1;
+        if(amt % 64 == 0)
+          write(fds[1], "x", 1);
+      }
+      write(fds[1], "e", 1);
       // sit around until killed
       for(;;) sleep(1000);
     }
-    if(pids[i] != -1)
-      read(fds[0], &scratch, 1);
-  }
-  kill(pids[0]);
-  wait();
-  if((pids[0] = fork()) == 0){
-     // allocate the full 640K page
-     sbrk(MAX_PROC_MEM - (uint)sbrk(0));
-     write(fds[1], "x", 1);
-     // sit around until killed
-     for(;;) sleep(1000);
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
     }
-  if(pids[0] != -1) {
-     read(fds[0], &scratch, 1);
-  } else {
-     printf(1, "fork failed\n");
-     exit();
-  }
-
-  // if those failed allocations freed up the pages they did allocate,
-  // we'll be able to allocate here
-  c = sbrk(PAGE);
-  for(i = 0; i < sizeof(pids)/sizeof(pids[0]); i++){
-    if(pids[i] == -1)
-      continue;
-    kill(pids[i]);
+    close(fds[1]);
+    got[i] = 0;
+    while(read(fds[0], &scratch, 1) == 1 && scratch == 'x')
+      got[i]++;
+    close(fds[0]);
+    kill(pid);
     wait();
   }
-  if(c == (char*)0xffffffff){
-    printf(stdout, "failed sbrk leaked memory\n");
+  if(got[0] == 0 || got[1] < got[0] - got[0]/10){
+    printf(stdout, "failed sbrk leaked memory, %d then %d\n", got[0]*64, got[1]*64);
     exit();
   }
 
@@ -1479,6 +1546,288 @@ bigargtest(void)
   wait();
 }
 
+// sbrk hands out pages when they are first touched;
+// system calls must be able to use them before the process does.
+void
+sbrklazy(void)
+{
+  char *a;
+  int fd;
+
+  printf(stdout, "sbrk lazy test\n");
+  a = sbrk(10*PAGE);
+  if(a == (char*)-1){
+    printf(stdout, "sbrk lazy: sbrk failed\n");
+    exit();
+  }
+  fd = open("README", 0);
+  if(fd < 0 || read(fd, a + 5*PAGE + 100, 10) != 10){
+    printf(stdout, "sbrk lazy: read into new memory failed\n");
+    exit();
+  }
+  close(fd);
+  if(a[0] != 0 || a[5*PAGE] != 0 || a[10*PAGE-1] != 0){
+    printf(stdout, "sbrk lazy: new memory not zero\n");
+    exit();
+  }
+  if(sbrk(-10*PAGE) == (char*)-1){
+    printf(stdout, "sbrk lazy: shrink failed\n");
+    exit();
+  }
+  printf(stdout, "sbrk lazy ok\n");
+}
+
+// parent and child share memory copy-on-write after fork:
+// writes by either, including by the kernel, must stay private.
+char cowbuf[3*PAGE];
+void
+cowtest(void)
+{
+  int i, pid, fds[2];
+
+  printf(stdout, "cow test\n");
+  for(i = 0; i < sizeof(cowbuf); i++)
+    cowbuf[i] = i%97;
+  if(pipe(fds) != 0){
+    printf(stdout, "cow: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "cow: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < sizeof(cowbuf); i++){
+      if(cowbuf[i] != i%97){
+        printf(stdout, "cow: child sees wrong data\n");
+        exit();
+      }
+    }
+    cowbuf[0] = 'c';
+    if(read(fds[0], cowbuf + PAGE, 5) != 5 || cowbuf[PAGE] != 'h'){
+      printf(stdout, "cow: read into shared page failed\n");
+      exit();
+    }
+    exit();
+  }
+  if(write(fds[1], "hello", 5) != 5){
+    printf(stdout, "cow: write failed\n");
+    exit();
+  }
+  wait();
+  cowbuf[2*PAGE] = 'p';
+  for(i = 0; i < 2*PAGE; i++){
+    if(cowbuf[i] != i%97){
+      printf(stdout, "cow: child's write reached parent\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "cow ok\n");
+}
+
+// map a file, read and write the mapping, and
+// check that it is shared with writers and children.
+void
+mmaptest(void)
+{
+  int fd, i, n, pid, ppid;
+  char *a, *b;
+
+  printf(stdout, "mmap test\n");
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "mmap: create failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i%26;
+  n = 2*PAGE + 100;
+  for(i = 0; i < n; i += sizeof(buf)){
+    if(write(fd, buf, n-i < sizeof(buf) ? n-i : sizeof(buf)) <= 0){
+      printf(stdout, "mmap: write failed\n");
+      exit();
+    }
+  }
+
+  a = mmap(fd, 0, n, PROT_READ);
+  if(a == (char*)-1){
+    printf(stdout, "mmap: mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(a[i] != 'a' + (i%sizeof(buf))%26){
+      printf(stdout, "mmap: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  for(; i < 3*PAGE; i++){
+    if(a[i] != 0){
+      printf(stdout, "mmap: tail not zero\n");
+      exit();
+    }
+  }
+
+  // private writable mapping of the same file
+  b = mmap(fd, PAGE, PAGE, PROT_READ|PROT_WRITE);
+  if(b == (char*)-1 || b == a){
+    printf(stdout, "mmap: second mmap failed\n");
+    exit();
+  }
+  b[0] = 'X';
+  if(a[PAGE] == 'X'){
+    printf(stdout, "mmap: private write reached the file\n");
+    exit();
+  }
+
+  // a write to the file shows in the read-only mapping
+  if(write(fd, "Y", 1) != 1){
+    printf(stdout, "mmap: write failed\n");
+    exit();
+  }
+  if(a[n] != 'Y'){
+    printf(stdout, "mmap: mapping missed a write\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "mmap: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(a[1] != 'b' || b[0] != 'X' || a[n] != 'Y'){
+      printf(stdout, "mmap: child sees wrong data\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+
+  if(munmap(a, 3*PAGE) < 0 || munmap(b, PAGE) < 0){
+    printf(stdout, "mmap: munmap failed\n");
+    exit();
+  }
+  ppid = getpid();
+  pid = fork();
+  if(pid == 0){
+    // touching an unmapped page must kill the process
+    printf(stdout, "oops could read unmapped %x = %x\n", a, a[0]);
+    kill(ppid);
+    exit();
+  }
+  wait();
+  close(fd);
+  unlink("mmapfile");
+  printf(stdout, "mmap ok\n");
+}
+
+// Read the page allocator statistics into st.
+void
+readmemstat(struct memstat *st)
+{
+  int fd;
+
+  fd = open("/dev/memstat", O_RDONLY);
+  if(fd < 0 || read(fd, st, sizeof(*st)) != sizeof(*st)){
+    printf(stdout, "memstat: cannot read /dev/memstat\n");
+    exit();
+  }
+  close(fd);
+}
+
+// Fork children that grow, pipe to a grandchild, and exit,
+// so that every page they used is freed again.
+void
+memstorm(void)
+{
+  int i, n, pid, fds[2];
+  char *p;
+
+  for(i = 0; i < 8; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "memstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(n = 0; n < 16*(i+1); n++){
+        if((p = sbrk(PAGE)) == (char*)-1)
+          break;
+        *p = n;
+      }
+      if(pipe(fds) != 0){
+        printf(stdout, "memstat: pipe failed\n");
+        exit();
+      }
+      if(fork() == 0){
+        close(fds[0]);
+        write(fds[1], "x", 1);
+        exit();
+      }
+      close(fds[1]);
+      read(fds[0], buf, 1);
+      close(fds[0]);
+      wait();
+      exit();
+    }
+    wait();
+  }
+}
+
+// Aligned free chunks of 2^k pages in the buddy lists.
+uint
+memchunks(struct memstat *st, int k)
+{
+  uint n;
+  int j;
+
+  n = 0;
+  for(j = k; j < MEMSTAT_NORDER; j++)
+    n += st->nblock[j] << (j - k);
+  return n;
+}
+
+// The buddy allocator must get back every page a fork, pipe and
+// sbrk storm used, merged into the blocks it started with.  Pages
+// in the per-CPU magazines are free but not in the buddy lists;
+// each can change the chunk count of an order by at most one.
+void
+memstattest(void)
+{
+  struct memstat st0, st1;
+  uint c0, c1, slack;
+  int k;
+
+  printf(stdout, "memstat test\n");
+  // Warm up: fill the slab caches and per-CPU magazines, so that
+  // only pages the storm fails to give back show up below.
+  memstorm();
+  readmemstat(&st0);
+  memstorm();
+  readmemstat(&st1);
+
+  if(st1.nfree != st0.nfree){
+    printf(stdout, "memstat: %d free pages before, %d after\n",
+           st0.nfree, st1.nfree);
+    exit();
+  }
+  slack = st0.ncached + st1.ncached;
+  for(k = 0; k < MEMSTAT_NORDER; k++){
+    c0 = memchunks(&st0, k);
+    c1 = memchunks(&st1, k);
+    if(c1 + slack < c0 || c0 + slack < c1){
+      printf(stdout, "memstat: order %d: %d chunks before, %d after\n",
+             k, c0, c1);
+      exit();
+    }
+  }
+  printf(stdout, "memstat ok\n");
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -1494,6 +1843,10 @@ main(int argc, char *argv[])
   bsstest();
   sbrktest();
   validatetest();
+  sbrklazy();
+  cowtest();
+  mmaptest();
+  memstattest();
 
   opentest();
   writetest();
@@ -1519,7 +1872,9 @@ main(int argc, char *argv[])
   iref();
   forktest();
   bigdir(); // slow
+  bigsubdir(); // slow
 
+  txtbusy();
   exectest();
 
   exit();